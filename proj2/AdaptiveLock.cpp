@@ -0,0 +1,86 @@
+#include "AdaptiveLock.h"
+#include "uthread_private.h"
+#include <algorithm>
+
+AdaptiveLock::AdaptiveLock()
+{
+    return;
+}
+
+void AdaptiveLock::lock( )
+{
+    if ( mutex.owner != nullptr )
+    {
+        unsigned long budget_ns = waitBudgetNs( );
+        if ( budget_ns > 0 )
+        {
+            waitForRelease( budget_ns );
+        }
+    }
+
+    // Free by now unless the budget ran out, in which case this blocks
+    mutex.lock( );
+
+    // Time every few holds, reading the clock costs about as much as an
+    // uncontended lock()
+    if ( ++acquisitions == ADAPTIVE_SAMPLE_PERIOD )
+    {
+        acquisitions = 0;
+        hold_start_ns = nowNs( );
+    }
+}
+
+void AdaptiveLock::unlock( )
+{
+    if ( hold_start_ns != 0 )
+    {
+        long sample = nowNs( ) - hold_start_ns;
+        hold_start_ns = 0;
+        average_hold_ns += ( sample - average_hold_ns ) / 8;
+    }
+
+    mutex.unlock( );
+}
+
+unsigned long AdaptiveLock::getAverageHoldNs( ) const
+{
+    return average_hold_ns;
+}
+
+unsigned long AdaptiveLock::waitBudgetNs( ) const
+{
+    // Waiting depends on the clock, which a replayed schedule cannot
+    // reproduce, so block right away while tracing
+    if ( schedule_tracing || average_hold_ns > ADAPTIVE_SPIN_MAX_NS )
+    {
+        return 0;
+    }
+    return std::min( 2 * average_hold_ns + 1, (long)ADAPTIVE_SPIN_MAX_NS );
+}
+
+void AdaptiveLock::waitForRelease( unsigned long budget_ns )
+{
+    unsigned long deadline_ns = nowNs( ) + budget_ns;
+    while ( true )
+    {
+        disableInterrupts( );
+        TCB *owner = mutex.owner;
+
+        // A blocked owner will not release the lock any time soon
+        bool keep_waiting = owner != nullptr && owner->getState( ) != BLOCK &&
+                            nowNs( ) < deadline_ns;
+
+        // Let the preempted owner run out this thread's quantum. If it is not
+        // on a ready queue (suspended, ...), there is nothing to wait for
+        if ( keep_waiting )
+        {
+            keep_waiting = yieldTo( owner );
+        }
+        enableInterrupts( );
+
+        if ( !keep_waiting )
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef ADAPTIVE_LOCK_H
+#define ADAPTIVE_LOCK_H
+
+#include "Lock.h"
+
+#define ADAPTIVE_SPIN_MAX_NS 20000  /* longest a thread waits before blocking */
+#define ADAPTIVE_SAMPLE_PERIOD 8    /* time one in this many holds */
+
+// Synchronization lock that waits a little before blocking. A thread finding
+// the lock held keeps trying for about twice the lock's recent hold time, and
+// only blocks (like Lock) if the lock is still held after that or is usually
+// held for longer than ADAPTIVE_SPIN_MAX_NS. Short critical sections get
+// SpinLock's behavior and long ones Lock's, without choosing at compile time
+// NOTE: With a single kernel thread the owner is never running while another
+//       thread waits for it, so instead of spinning the waiting thread gives
+//       the rest of its quantum to the preempted owner
+class AdaptiveLock {
+public:
+  AdaptiveLock();
+
+  // Acquire the lock. If the lock is held, wait for it to be released for a
+  // while, then block until the lock is handed over
+  void lock();
+
+  // Unlock the lock. If a thread is blocked on the lock, ownership is handed
+  // to the first one
+  void unlock();
+
+  // Return the recent average time the lock was held, in nanoseconds
+  unsigned long getAverageHoldNs() const;
+
+private:
+  Lock mutex;                       // Lock threads block on after waiting
+  unsigned int acquisitions = 0;    // Acquisitions since the last timed hold
+  unsigned long hold_start_ns = 0;  // When the current hold started, 0 if not timed
+  long average_hold_ns = 0;         // Moving average of the timed holds
+
+  // Return how long a thread finding the lock held should keep trying
+  unsigned long waitBudgetNs() const;
+
+  // Keep giving the owner the CPU until the lock is released, the owner
+  // blocks or budget_ns passes
+  void waitForRelease(unsigned long budget_ns);
+};
+
+#endif // ADAPTIVE_LOCK_H
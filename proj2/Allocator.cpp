@@ -0,0 +1,206 @@
+#include "Allocator.h"
+#include "uthread_private.h"
+#include <cassert>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ALLOC_CHUNK_SIZE (64 * 1024)  // Depot refill size for small blocks
+#define ALLOC_LARGE ALLOC_CLASSES     // Size class of blocks from malloc
+
+// In front of every block, keeps the payload 16-byte aligned
+struct alignas(16) BlockHeader
+{
+        size_t size_class;
+};
+
+// Free blocks of one size class shared by all threads, linked through their
+// first word
+struct DepotList
+{
+        void* head;
+        int count;
+};
+
+static DepotList _depot[ALLOC_CLASSES];
+
+// Return the size class for a small request
+static inline int sizeClass(size_t size)
+{
+        if (size <= ALLOC_MIN_SIZE)
+        {
+                return 0;
+        }
+        // Round up to the next power of two, 16 is class 0
+        return (64 - __builtin_clzl(size - 1)) - 4;
+}
+
+static inline size_t blockSize(int size_class)
+{
+        return sizeof(BlockHeader) + ((size_t)ALLOC_MIN_SIZE << size_class);
+}
+
+/*
+ * Carves a fresh chunk into blocks of the size class
+ * NOTE: Callers must have preemption disabled
+ */
+static bool growDepot(int size_class)
+{
+        // Chunks are never returned, their blocks are reused
+        char* chunk = (char*)malloc(ALLOC_CHUNK_SIZE);
+        if (chunk == NULL)
+        {
+                return false;
+        }
+
+        size_t size = blockSize(size_class);
+        DepotList& depot = _depot[size_class];
+        for (size_t offset = 0; offset + size <= ALLOC_CHUNK_SIZE; offset += size)
+        {
+                void* block = chunk + offset;
+                *(void**)block = depot.head;
+                depot.head = block;
+                depot.count++;
+        }
+        return true;
+}
+
+/*
+ * Moves up to count blocks between two free lists
+ */
+static void moveBlocks(void** from, int* from_count, void** to, int* to_count, int count)
+{
+        while (count-- > 0 && *from != NULL)
+        {
+                void* block = *from;
+                *from = *(void**)block;
+                *(void**)block = *to;
+                *to = block;
+                (*from_count)--;
+                (*to_count)++;
+        }
+}
+
+// NOTE: Callers must have preemption disabled
+static void* allocSmall(int size_class)
+{
+        AllocCache* cache = (running != NULL) ? running->getAllocCache() : NULL;
+        DepotList& depot = _depot[size_class];
+
+        if (cache == NULL)
+        {
+                // Not a uthread yet, go straight to the depot
+                if (depot.head == NULL && !growDepot(size_class))
+                {
+                        return NULL;
+                }
+                void* block = depot.head;
+                depot.head = *(void**)block;
+                depot.count--;
+                return block;
+        }
+
+        if (cache->free[size_class] == NULL)
+        {
+                if (depot.count < ALLOC_BATCH && !growDepot(size_class) && depot.head == NULL)
+                {
+                        return NULL;
+                }
+                moveBlocks(&depot.head, &depot.count, &cache->free[size_class],
+                           &cache->count[size_class], ALLOC_BATCH);
+        }
+
+        void* block = cache->free[size_class];
+        cache->free[size_class] = *(void**)block;
+        cache->count[size_class]--;
+        return block;
+}
+
+// NOTE: Callers must have preemption disabled
+static void freeSmall(BlockHeader* block)
+{
+        int size_class = block->size_class;
+        AllocCache* cache = (running != NULL) ? running->getAllocCache() : NULL;
+        DepotList& depot = _depot[size_class];
+
+        if (cache == NULL)
+        {
+                *(void**)block = depot.head;
+                depot.head = block;
+                depot.count++;
+                return;
+        }
+
+        *(void**)block = cache->free[size_class];
+        cache->free[size_class] = block;
+        cache->count[size_class]++;
+
+        // Keep the cache bounded, other threads may need the blocks
+        if (cache->count[size_class] > ALLOC_CACHE_LIMIT)
+        {
+                moveBlocks(&cache->free[size_class], &cache->count[size_class],
+                           &depot.head, &depot.count, ALLOC_BATCH);
+        }
+}
+
+void releaseAllocCache(AllocCache* cache)
+{
+        preemptDisable();
+        for (int size_class = 0; size_class < ALLOC_CLASSES; size_class++)
+        {
+                moveBlocks(&cache->free[size_class], &cache->count[size_class],
+                           &_depot[size_class].head, &_depot[size_class].count,
+                           cache->count[size_class]);
+        }
+        preemptEnable();
+}
+
+/* Allocate memory */
+void* uthread_malloc(size_t size)
+{
+        BlockHeader* block;
+        preemptDisable();
+        if (size > ALLOC_MAX_SMALL)
+        {
+                // malloc takes a lock a preempted thread could be holding
+                block = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+                if (block != NULL)
+                {
+                        block->size_class = ALLOC_LARGE;
+                }
+        }
+        else
+        {
+                block = (BlockHeader*)allocSmall(sizeClass(size));
+                if (block != NULL)
+                {
+                        // The free list link overwrote the header
+                        block->size_class = sizeClass(size);
+                }
+        }
+        preemptEnable();
+
+        return (block != NULL) ? block + 1 : NULL;
+}
+
+/* Free memory from uthread_malloc */
+void uthread_free(void* ptr)
+{
+        if (ptr == NULL)
+        {
+                return;
+        }
+
+        BlockHeader* block = (BlockHeader*)ptr - 1;
+        assert(block->size_class <= ALLOC_LARGE);
+
+        preemptDisable();
+        if (block->size_class == ALLOC_LARGE)
+        {
+                free(block);
+        }
+        else
+        {
+                freeSmall(block);
+        }
+        preemptEnable();
+}
@@ -0,0 +1,51 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "uthread.h"
+#include <cstddef>
+#include <new>
+
+#define ALLOC_CLASSES     8    /* small size classes, 16 to 2048 bytes */
+#define ALLOC_MIN_SIZE    16
+#define ALLOC_MAX_SMALL   (ALLOC_MIN_SIZE << (ALLOC_CLASSES - 1))
+#define ALLOC_CACHE_LIMIT 64   /* free blocks per class a thread keeps */
+#define ALLOC_BATCH       32   /* blocks moved between a thread and the depot at once */
+
+// Free blocks a thread keeps for itself, one list per size class. Lives in
+// the TCB
+struct AllocCache
+{
+  void *free[ALLOC_CLASSES];
+  int count[ALLOC_CLASSES];
+};
+
+// Hand every block in the cache back to the central depot
+void releaseAllocCache(AllocCache *cache);
+
+// STL allocator on top of uthread_malloc, for containers the library grows
+// while threads can be preempted
+template <typename T>
+class UthreadAllocator {
+public:
+  typedef T value_type;
+
+  UthreadAllocator() {}
+  template <typename U> UthreadAllocator(const UthreadAllocator<U> &) {}
+
+  T* allocate(size_t n)
+  {
+    void *p = uthread_malloc(n * sizeof(T));
+    if (p == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, size_t) { uthread_free(p); }
+
+  template <typename U> bool operator==(const UthreadAllocator<U> &) const { return true; }
+  template <typename U> bool operator!=(const UthreadAllocator<U> &) const { return false; }
+};
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,90 @@
+#include "CeilingLock.h"
+#include "uthread_private.h"
+#include <algorithm>
+#include <cassert>
+
+CeilingLock::CeilingLock(Priority ceiling) : ceiling(ceiling)
+{
+    return;
+}
+
+Priority CeilingLock::getCeiling( ) const
+{
+    return ceiling;
+}
+
+void CeilingLock::setOwner( TCB *tcb )
+{
+    // The raise only touches the owner's own fields. The owner is running or
+    // blocked, never on a ready queue, so nothing has to be requeued
+    owner = tcb;
+    saved_priority = tcb->getCeilingPriority( );
+    tcb->setCeilingPriority( std::max( ceiling, saved_priority ) );
+}
+
+void CeilingLock::lock( )
+{
+    // Uncontended case, only keep the timer from switching threads in between
+    preemptDisable( );
+    if ( owner == nullptr && !schedule_tracing )
+    {
+        setOwner( running );
+        running->increaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    if ( owner == nullptr )
+    {
+        setOwner( running );
+    }
+    else
+    {
+        // Sleep until unlock() hands the lock over, raised to the ceiling
+        assert( owner != running );
+        lock_queue.push( running );
+        running->setState( BLOCK );
+        switchThreads( );
+        assert( owner == running );
+    }
+    running->increaseLockCount();
+    enableInterrupts( );
+}
+
+void CeilingLock::unlock( )
+{
+    preemptDisable( );
+    if ( lock_queue.empty( ) && !schedule_tracing )
+    {
+        assert( owner == running );
+        running->setCeilingPriority( saved_priority );
+        owner = nullptr;
+        running->decreaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    assert( owner == running );
+    running->setCeilingPriority( saved_priority );
+    running->decreaseLockCount();
+
+    if ( lock_queue.empty( ) )
+    {
+        owner = nullptr;
+    }
+    else
+    {
+        // Hand the lock straight to the first waiter, it is queued at the
+        // ceiling priority
+        TCB *next = lock_queue.front( );
+        lock_queue.pop( );
+        setOwner( next );
+        next->setState( READY );
+        addToReady( next );
+    }
+    enableInterrupts( );
+}
@@ -0,0 +1,39 @@
+#ifndef CEILING_LOCK_H
+#define CEILING_LOCK_H
+
+#include "TCB.h"
+#include "TCBQueue.h"
+
+// Synchronization lock following the immediate priority ceiling protocol. The
+// holder runs at the lock's ceiling priority for as long as it holds the
+// lock, so no thread at or below the ceiling can preempt it and a thread
+// blocks on at most one critical section of a lower-priority thread
+// NOTE: Nested ceiling locks must be released in the reverse order they were
+//       acquired
+class CeilingLock {
+public:
+  // ceiling must be at least the priority of every thread that takes the lock
+  CeilingLock(Priority ceiling);
+
+  // Acquire the lock and raise the calling thread to the ceiling. If the lock
+  // is held, the thread is blocked until the lock is handed to it
+  void lock();
+
+  // Restore the calling thread's previous priority and unlock the lock. If a
+  // thread is blocked on the lock, ownership is handed to the first one
+  void unlock();
+
+  // Return the ceiling priority
+  Priority getCeiling() const;
+
+private:
+  Priority ceiling;
+  TCB *owner = nullptr;           // Thread holding the lock, nullptr if free
+  TCBQueue lock_queue;            // Threads blocked in lock(), in FIFO order
+  Priority saved_priority = MIN_PRIORITY;  // Owner's ceiling priority before it took the lock
+
+  // Make tcb the owner and raise it to the ceiling
+  void setOwner(TCB *tcb);
+};
+
+#endif // CEILING_LOCK_H
@@ -1,7 +1,7 @@
 #include "CondVar.h"
 #include "uthread_private.h"
 
-CondVar::CondVar() {
+CondVar::CondVar(CondVarMode mode) : mode(mode) {
     return;
 }
 
@@ -10,37 +10,93 @@ void CondVar::wait(Lock &lock) {
     std::cout << "[" << uthread_self( ) << "] Waiting and ";
 #endif
     disableInterrupts( );
-    if ( mutex_lock == nullptr )
+
+    // Remember the lock for signal() and broadcast()
+    mutex_lock = &lock;
+
+    // Block running thread and place on waiting queue, then release the lock
+    waiters.push( running );
+    running->setState( BLOCK );
+    TCB *signaler = lock._unlock( );
+    if ( signaler != nullptr )
     {
-        // Set member variable to remember this lock
-        mutex_lock = &lock;
+        switchToThread( signaler );
+    }
+    else
+    {
+        switchThreads( );
     }
 
-    lock._unlock( );
-    
-    // Block running thread and place on waiting queue
-    lock.addToWaitingQueue( running );
-
-    // Thread should return here after being signaled
+    // Thread returns here after being signaled
 #if DEBUG
     std::cout << "[" << running->getId( ) << "] Done waiting and " << std::endl;
 #endif
+    lock._relock( );
+    enableInterrupts( );
+}
 
-    // Re-acquire lock and re-enable interrupts
-    lock.lock( );
+bool CondVar::wait_for(Lock &lock, std::chrono::nanoseconds timeout) {
+    disableInterrupts( );
+    long timeout_ns = timeout.count( ) > 0 ? (long)timeout.count( ) : 0;
+    bool signalled = waitUntilNs( lock, nowNs( ) + timeout_ns );
     enableInterrupts( );
+    return signalled;
+}
+
+bool CondVar::wait_until(Lock &lock, std::chrono::steady_clock::time_point deadline) {
+    disableInterrupts( );
+    // NOTE: Measure from now on both clocks instead of assuming steady_clock
+    //       counts from the same epoch as CLOCK_MONOTONIC
+    std::chrono::nanoseconds timeout = deadline - std::chrono::steady_clock::now( );
+    long timeout_ns = timeout.count( ) > 0 ? (long)timeout.count( ) : 0;
+    bool signalled = waitUntilNs( lock, nowNs( ) + timeout_ns );
+    enableInterrupts( );
+    return signalled;
+}
+
+bool CondVar::waitUntilNs(Lock &lock, unsigned long deadline_ns) {
+    mutex_lock = &lock;
+
+    // Same as wait(), with the scheduler's timer armed while blocked
+    waiters.push( running );
+    running->setState( BLOCK );
+    TCB *signaler = lock._unlock( );
+    bool signalled = blockUntil( deadline_ns, cancelWait, this, signaler );
+
+    lock._relock( );
+    return signalled;
+}
+
+bool CondVar::cancelWait(TCB *tcb, void *) {
+    if ( tcb->getBlockedOn( ) != nullptr )
+    {
+        // Broadcast already counts as the wake-up, it just waits for the lock
+        return false;
+    }
+    TCBQueue::remove( tcb );
+    return true;
 }
 
 void CondVar::signal()
 {
     disableInterrupts( );
-    if ( mutex_lock != nullptr )
+    if ( mutex_lock != nullptr && mode == MESA_SEMANTICS )
+    {
+        mutex_lock->_notify( waiters );
+    }
+    else if ( mutex_lock != nullptr )
     {
-        mutex_lock->_signal( running );
+        mutex_lock->_signal( running, waiters );
     }
     enableInterrupts( );
 }
 
-void CondVar::broadcast() {
-    signal( );
+void CondVar::broadcast()
+{
+    disableInterrupts( );
+    if ( mutex_lock != nullptr )
+    {
+        mutex_lock->_broadcast( waiters );
+    }
+    enableInterrupts( );
 }
\ No newline at end of file
@@ -3,33 +3,60 @@
 
 #include "TCB.h"
 #include "Lock.h"
-#include <queue>
+#include "TCBQueue.h"
+#include <chrono>
+
+// What signal() does with the waiting thread
+enum CondVarMode {
+  HOARE_SEMANTICS,  // Run it right away, the signalling thread waits for the lock back
+  MESA_SEMANTICS    // Make it ready, the signalling thread keeps running
+};
 
 // Synchronization condition variable
-// NOTE: Follows Hoare semantics
+// NOTE: Follows Hoare semantics unless constructed with MESA_SEMANTICS
 class CondVar {
 public:
-  CondVar();
+  CondVar(CondVarMode mode = HOARE_SEMANTICS);
 
   // Release the lock and block this thread atomically. Thread is woken up when
   // signalled or broadcasted
   void wait(Lock &lock);
 
+  // Like wait(), but stop waiting once timeout has passed. A thread that times
+  // out is taken off the waiting queue right away and takes the lock again
+  // before returning, like after a signal
+  // Return false if the thread timed out
+  bool wait_for(Lock &lock, std::chrono::nanoseconds timeout);
+
+  // Like wait_for(), but stop waiting once deadline is reached
+  bool wait_until(Lock &lock, std::chrono::steady_clock::time_point deadline);
+
   // Following Hoare semantics, if a thread is waiting, atomically transfer
   // control to the waiting thread and have control return to this thread after
   // the woken up thread has released the lock
+  // Following Mesa semantics, make the first waiting thread ready and keep
+  // running. The woken thread takes the lock again when it runs, by then the
+  // condition may no longer hold and it has to check again
   void signal();
 
-  // Following Hoare semantics, if thread(s) are waiting, atomically transfer
-  // control to each in a row and have control return to this thread after the
-  // last woken up thread has released the lock (i.e. threads should run in the
-  // following order: queue[head], queue[head+1], ..., queue[tail], calling
-  // thread)
+  // Move every waiting thread to the lock's queue at once. They get the lock
+  // one at a time as it is released, in the order they started waiting,
+  // instead of all waking up to compete for it. The calling thread keeps
+  // running
   void broadcast();
 
 private:
-  bool is_signaled = false;
-  Lock *mutex_lock = nullptr;
+  // Wait until signalled or CLOCK_MONOTONIC reaches deadline_ns
+  bool waitUntilNs(Lock &lock, unsigned long deadline_ns);
+
+  // Take tcb off the waiting queue when its wait times out, unless a broadcast
+  // has already moved it to the lock's queue
+  // NOTE: Assumes interrupts are disabled
+  static bool cancelWait(TCB *tcb, void *arg);
+
+  CondVarMode mode;
+  TCBQueue waiters;             // Threads blocked in wait(), in FIFO order
+  Lock *mutex_lock = nullptr;   // Lock passed to the last wait()
 };
 
 #endif // COND_VAR_H
@@ -0,0 +1,156 @@
+#include "Context.h"
+#include <cassert>
+#include <stdint.h>
+
+#if UCONTEXT_SWITCH
+
+void initContext(Context *ctx, char *stack, size_t stack_size,
+                 void (*entry)(void *(*)(void *), void *),
+                 void *(*start_routine)(void *), void *arg)
+{
+        // Carve the context out of the top of the stack, keeping the stack
+        // below it 16-byte aligned
+        stack_size = (stack_size - sizeof(ucontext_t)) & ~(size_t)15;
+        *ctx = (ucontext_t*)(stack + stack_size);
+
+        getcontext(*ctx);
+        (*ctx)->uc_stack.ss_sp = stack;
+        (*ctx)->uc_stack.ss_size = stack_size;
+        (*ctx)->uc_stack.ss_flags = 0;
+        makecontext(*ctx, (void(*)())entry, 2, start_routine, arg);
+}
+
+void initMainContext(Context *ctx)
+{
+        *ctx = new ucontext_t;
+}
+
+void freeMainContext(Context *ctx)
+{
+        delete *ctx;
+        *ctx = nullptr;
+}
+
+void switchContext(Context *from, Context *to)
+{
+        if (from == to)
+        {
+                return;
+        }
+
+        // ucontext always carries the FP environment and signal mask
+        swapcontext(*from, *to);
+}
+
+#else
+
+// Saved by switchContext below the return address, lowest address first
+struct SavedRegisters
+{
+        uint32_t mxcsr;
+        uint16_t fpcw;
+        uint16_t padding;
+        void* r15;
+        void* r14;
+        void* r13;
+        void* r12;
+        void* rbx;
+        void* rbp;
+        void* ret;
+};
+
+extern "C" void uthreadSwitchContext(Context *from, Context to);
+extern "C" void uthreadContextStart();
+
+// Everything the SysV ABI does not let a call clobber: the callee-saved
+// registers and the FP control registers.
+// Vector registers are caller-saved, so a thread switching through a call
+// has nothing live in them, and a thread preempted by the timer has all of
+// its FP/SIMD state in the kernel's signal frame on its own stack
+asm(R"(
+        .text
+        .globl uthreadSwitchContext
+        .type uthreadSwitchContext, @function
+uthreadSwitchContext:
+        pushq %rbp
+        pushq %rbx
+        pushq %r12
+        pushq %r13
+        pushq %r14
+        pushq %r15
+        subq $8, %rsp
+        stmxcsr (%rsp)
+        fnstcw 4(%rsp)
+        movq %rsp, (%rdi)
+        movq %rsi, %rsp
+        ldmxcsr (%rsp)
+        fldcw 4(%rsp)
+        addq $8, %rsp
+        popq %r15
+        popq %r14
+        popq %r13
+        popq %r12
+        popq %rbx
+        popq %rbp
+        ret
+        .size uthreadSwitchContext, .-uthreadSwitchContext
+
+        .globl uthreadContextStart
+        .type uthreadContextStart, @function
+uthreadContextStart:
+        movq %r12, %rdi
+        movq %r13, %rsi
+        callq *%r14
+        ud2
+        .size uthreadContextStart, .-uthreadContextStart
+)");
+
+void initContext(Context *ctx, char *stack, size_t stack_size,
+                 void (*entry)(void *(*)(void *), void *),
+                 void *(*start_routine)(void *), void *arg)
+{
+        // The first switch to the thread "returns" into uthreadContextStart,
+        // which calls entry(start_routine, arg) with the stack 16-byte aligned
+        uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+        SavedRegisters* regs = (SavedRegisters*)(top - sizeof(SavedRegisters));
+        static_assert(sizeof(SavedRegisters) % 16 == 0, "entry stack must stay aligned");
+
+        // A new thread starts with the FP control state of the thread
+        // creating it, like a pthread
+        asm volatile("stmxcsr %0" : "=m"(regs->mxcsr));
+        asm volatile("fnstcw %0" : "=m"(regs->fpcw));
+        regs->padding = 0;
+        regs->r15 = nullptr;
+        regs->r14 = (void*)entry;
+        regs->r13 = arg;
+        regs->r12 = (void*)start_routine;
+        regs->rbx = nullptr;
+        regs->rbp = nullptr;
+        regs->ret = (void*)uthreadContextStart;
+        *ctx = regs;
+}
+
+void initMainContext(Context *ctx)
+{
+        // Filled in by the main thread's first switch
+        *ctx = nullptr;
+}
+
+void freeMainContext(Context *ctx)
+{
+        *ctx = nullptr;
+}
+
+void switchContext(Context *from, Context *to)
+{
+        // to is read before from is written, so switching to the running
+        // thread itself would resume its previous save
+        if (from == to)
+        {
+                return;
+        }
+
+        uthreadSwitchContext(from, *to);
+}
+
+#endif
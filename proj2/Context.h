@@ -0,0 +1,43 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+#include <ucontext.h>
+
+// On x86-64 threads are switched by a few instructions that only save the
+// callee-saved registers. Elsewhere, or when built with -DUCONTEXT_SWITCH=1,
+// getcontext/makecontext/swapcontext are used
+#ifndef UCONTEXT_SWITCH
+#if defined(__x86_64__)
+#define UCONTEXT_SWITCH 0
+#else
+#define UCONTEXT_SWITCH 1
+#endif
+#endif
+
+// Saved execution state of a thread that is not running
+#if UCONTEXT_SWITCH
+typedef ucontext_t* Context;
+#else
+typedef void* Context;  // Stack pointer to the thread's saved registers
+#endif
+
+// Set up ctx to run entry(start_routine, arg) on the stack [stack, stack + stack_size)
+// NOTE: The context may be stored at the top of the stack
+void initContext(Context *ctx, char *stack, size_t stack_size,
+                 void (*entry)(void *(*)(void *), void *),
+                 void *(*start_routine)(void *), void *arg);
+
+// Set up/free ctx for the thread running on the process stack
+void initMainContext(Context *ctx);
+void freeMainContext(Context *ctx);
+
+// Save the running thread to from and resume the thread saved in to. Returns
+// once another thread switches back to from. The x87 control word and MXCSR
+// (rounding mode, exception masks, flush-to-zero) are saved with the running
+// thread and restored when it resumes, so every thread keeps its own
+// NOTE: The signal mask is not switched, every thread switches with
+//       interrupts disabled
+void switchContext(Context *from, Context *to);
+
+#endif // CONTEXT_H
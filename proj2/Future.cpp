@@ -0,0 +1,109 @@
+#include "Future.h"
+#include "uthread_private.h"
+
+namespace uthread {
+
+FutureCore* FutureCore::allocate(size_t storage_size)
+{
+    // uthread_malloc's size classes and thread caches pool the slots, without
+    // masking the timer
+    void *slot = uthread_malloc(sizeof(FutureCore) + storage_size);
+    if (slot == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return new (slot) FutureCore();
+}
+
+void FutureCore::release(FutureCore *core)
+{
+    core->~FutureCore();
+    uthread_free(core);
+}
+
+void FutureCore::complete()
+{
+    disableInterrupts();
+    done = true;
+
+    // NOTE: A thread in waitAny can be registered on several cores, only the
+    //       first core to complete wakes it up
+    if (waiter && waiter->getState() == BLOCK)
+    {
+        waiter->setState(READY);
+        addToReady(waiter);
+    }
+    waiter = nullptr;
+    enableInterrupts();
+}
+
+void FutureCore::wait()
+{
+    disableInterrupts();
+    if (!done)
+    {
+        // Block until complete() wakes this thread up
+        assert(waiter == nullptr);
+        waiter = running;
+        running->setState(BLOCK);
+        switchThreads();
+    }
+    enableInterrupts();
+}
+
+void FutureCore::join()
+{
+    if (tid >= 0)
+    {
+        uthread_join(tid, nullptr);
+        tid = -1;
+    }
+}
+
+int FutureCore::waitAny(FutureCore *const *cores, int count)
+{
+    disableInterrupts();
+
+    // Register on every core unless one has completed in the meantime
+    int ready = -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (cores[i]->done)
+        {
+            ready = i;
+            break;
+        }
+    }
+
+    if (ready < 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            assert(cores[i]->waiter == nullptr);
+            cores[i]->waiter = running;
+        }
+
+        running->setState(BLOCK);
+        switchThreads();
+
+        // Woken up by the first core to complete, unregister from the rest
+        for (int i = 0; i < count; i++)
+        {
+            if (cores[i]->waiter == running)
+            {
+                cores[i]->waiter = nullptr;
+            }
+            else if (ready < 0 && cores[i]->done)
+            {
+                ready = i;
+            }
+        }
+    }
+
+    enableInterrupts();
+
+    assert(ready >= 0);
+    return ready;
+}
+
+} // namespace uthread
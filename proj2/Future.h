@@ -0,0 +1,194 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include "uthread.h"
+#include "Spawn.h"
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+class TCB;
+
+namespace uthread {
+
+// Completion state shared between an async thread and its future. Cores are
+// allocated with uthread_malloc and the result is constructed in place right
+// after the core, so returning a value never needs its own heap buffer
+class alignas(std::max_align_t) FutureCore {
+public:
+  // Get a slot with room for storage_size bytes after the core
+  static FutureCore* allocate(size_t storage_size);
+
+  // Free the slot
+  static void release(FutureCore *core);
+
+  // Storage for the result
+  void* storage() { return this + 1; }
+
+  // Return true once the result has been stored
+  bool isReady() const { return done; }
+
+  // Mark the result as stored and wake the thread waiting on it, if any
+  void complete();
+
+  // Block the calling thread until complete() has been called
+  void wait();
+
+  // Reap the thread that computed the result
+  void join();
+
+  // Block the calling thread until any of the cores completes
+  // Return the index of a completed core
+  static int waitAny(FutureCore *const *cores, int count);
+
+  int tid = -1;               // Thread computing the result, -1 if none
+
+private:
+  volatile bool done = false;
+  TCB *waiter = nullptr;      // Thread blocked on this core
+};
+
+// Result of a computation running on its own uthread
+template <typename T>
+class future {
+public:
+  future() : core(nullptr) {}
+  future(future &&other) : core(other.core) { other.core = nullptr; }
+  future& operator=(future &&other)
+  {
+    if (this != &other)
+    {
+      reset();
+      core = other.core;
+      other.core = nullptr;
+    }
+    return *this;
+  }
+  future(const future &) = delete;
+  future& operator=(const future &) = delete;
+
+  // Like std::async futures, an unretrieved result is waited for here
+  ~future() { reset(); }
+
+  // Return true if the future refers to a result that has not been retrieved
+  bool valid() const { return core != nullptr; }
+
+  // Return true if the result is available without blocking
+  bool is_ready() const { return core && core->isReady(); }
+
+  // Block the calling thread until the result is available
+  void wait() { assert(core); core->wait(); }
+
+  // Block the calling thread until the result is available, then move it out
+  // NOTE: The future is no longer valid afterwards
+  T get()
+  {
+    assert(core);
+    core->wait();
+    T *result = static_cast<T *>(core->storage());
+    T value(std::move(*result));
+    reset();
+    return value;
+  }
+
+private:
+  FutureCore *core;
+
+  explicit future(FutureCore *c) : core(c) {}
+
+  void reset()
+  {
+    if (core)
+    {
+      core->wait();
+      static_cast<T *>(core->storage())->~T();
+      core->join();
+      FutureCore::release(core);
+      core = nullptr;
+    }
+  }
+
+  template <typename U, typename F> friend future<U> async(F &&fn);
+  template <typename U> friend int when_any(future<U> *futures, int count);
+};
+
+// Run fn() on a new uthread and return a future for its result. The callable
+// lives at the top of the new thread's stack and the result is constructed
+// in the core's slot. If no thread can be created, fn() runs on the calling
+// thread instead
+template <typename T, typename F>
+future<T> async(F &&fn)
+{
+  static_assert(!std::is_void<T>::value, "async needs a result type");
+  static_assert(alignof(T) <= alignof(std::max_align_t), "result is over-aligned");
+
+  FutureCore *core = FutureCore::allocate(sizeof(T));
+  auto task = [core, fn = std::forward<F>(fn)]() mutable {
+    new (core->storage()) T(fn());
+    core->complete();
+  };
+
+  // NOTE: task is only moved from if the thread was created
+  int tid = spawn(std::move(task));
+  if (tid < 0)
+  {
+    task();
+  }
+  core->tid = tid;
+
+  return future<T>(core);
+}
+
+// Block the calling thread until every valid future has its result
+template <typename T>
+void when_all(future<T> *futures, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (futures[i].valid())
+    {
+      futures[i].wait();
+    }
+  }
+}
+
+// Block the calling thread until one of the valid futures has its result
+// Return the index of a ready future, -1 if none of the futures are valid
+template <typename T>
+int when_any(future<T> *futures, int count)
+{
+  // NOTE: Every pending future owns a live thread, so there are at most
+  //       MAX_THREAD_NUM of them
+  FutureCore *cores[MAX_THREAD_NUM];
+  int indices[MAX_THREAD_NUM];
+  int pending = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (!futures[i].valid())
+    {
+      continue;
+    }
+    if (futures[i].is_ready())
+    {
+      return i;
+    }
+    assert(pending < MAX_THREAD_NUM);
+    cores[pending] = futures[i].core;
+    indices[pending] = i;
+    pending++;
+  }
+
+  if (pending == 0)
+  {
+    return -1;
+  }
+
+  return indices[FutureCore::waitAny(cores, pending)];
+}
+
+} // namespace uthread
+
+#endif // FUTURE_H
@@ -1,26 +1,101 @@
 #include "Lock.h"
+#include "LockProfile.h"
 #include "uthread_private.h"
+#include <algorithm>
+#include <new>
 
 Lock::Lock()
 {
-    // Lock is initialized with ATOMIC_FLAG_INIT
     return;
 }
 
+Lock::Lock(const char *name)
+{
+    void *memory = uthread_malloc( sizeof( LockProfile ) );
+    if ( memory == nullptr )
+    {
+        throw std::bad_alloc( );
+    }
+    profile = new ( memory ) LockProfile( name );
+}
+
+Lock::~Lock()
+{
+    if ( profile != nullptr )
+    {
+        profile->~LockProfile( );
+        uthread_free( profile );
+    }
+}
+
 void Lock::lock( )
 {
 #if DEBUG
     std::cout << "[" << uthread_self( ) << "] Locking" << std::endl;
 #endif
+    // Uncontended case, only keep the timer from switching threads in between
+    preemptDisable( );
+    if ( owner == nullptr && !schedule_tracing )
+    {
+        setOwner( running );
+        running->increaseLockCount();
+        if ( lock_profiling && profile != nullptr )
+        {
+            profile->acquired( 0 );
+        }
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
     disableInterrupts( );
-    while ( atomic_value.test_and_set( ) )
+    unsigned long wait_start_ns = 0;
+    if ( lock_profiling && profile != nullptr && owner != nullptr )
+    {
+        wait_start_ns = nowNs( );
+    }
+    _lock( );
+    if ( lock_profiling && profile != nullptr )
     {
-        uthread_yield( );
+        profile->acquired( wait_start_ns );
     }
+    enableInterrupts( );
+}
 
-    // Thread picks up lock when it falls out of while loop
-    running->increaseLockCount();
+bool Lock::try_lock_for( std::chrono::nanoseconds timeout )
+{
+    preemptDisable( );
+    if ( owner == nullptr && !schedule_tracing )
+    {
+        setOwner( running );
+        running->increaseLockCount();
+        if ( lock_profiling && profile != nullptr )
+        {
+            profile->acquired( 0 );
+        }
+        preemptEnable( );
+        return true;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    unsigned long wait_start_ns = nowNs( );
+    bool owner_was_free = owner == nullptr;
+    long timeout_ns = std::max( (long)timeout.count( ), 0L );
+    bool acquired = _lockUntil( wait_start_ns + timeout_ns );
+    if ( lock_profiling && profile != nullptr )
+    {
+        if ( acquired )
+        {
+            profile->acquired( owner_was_free ? 0 : wait_start_ns );
+        }
+        else
+        {
+            profile->timedOut( wait_start_ns );
+        }
+    }
     enableInterrupts( );
+    return acquired;
 }
 
 void Lock::unlock( )
@@ -28,87 +103,392 @@ void Lock::unlock( )
 #if DEBUG
     std::cout << "[" << uthread_self( ) << "] Unlocking" << std::endl;
 #endif
-    disableInterrupts( );
+    preemptDisable( );
+    if ( lock_queue.empty( ) && !schedule_tracing )
+    {
+        assert( owner == running );
+        if ( lock_profiling && profile != nullptr )
+        {
+            profile->released( );
+        }
+        clearOwner( );
+        running->decreaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
 
-    // Release lock
-    running->decreaseLockCount();
-    atomic_value.clear();
+    disableInterrupts( );
 
-    if ( is_signaled )
+    TCB *signaler = _unlock( );
+    if ( signaler != nullptr )
     {
     #if DEBUG
-        std::cout << "[" << uthread_self( ) << "] Switching back to " << signaling_thread->getId( ) << std::endl;
+        std::cout << "[" << uthread_self( ) << "] Switching back to " << signaler->getId( ) << std::endl;
     #endif
-        switchToThread( signaling_thread );
+        running->setState( READY );
+        addToReady( running );
+        switchToThread( signaler );
     }
 
     enableInterrupts( );
 }
 
-void Lock::_signal(TCB *tcb)
+void Lock::_lock( )
+{
+    if ( owner == nullptr )
+    {
+        setOwner( running );
+    }
+    else
+    {
+        // Sleep until unlock() hands the lock over, there is nothing to retry
+        assert( owner != running );
+        addToLockQueue( running, false );
+        running->setState( BLOCK );
+        switchThreads( );
+        assert( owner == running );
+    }
+
+    running->increaseLockCount();
+}
+
+bool Lock::_lockUntil( unsigned long deadline_ns )
+{
+    if ( owner == nullptr )
+    {
+        setOwner( running );
+    }
+    else
+    {
+        assert( owner != running );
+        if ( nowNs( ) >= deadline_ns )
+        {
+            return false;
+        }
+
+        // Sleep until unlock() hands the lock over or the scheduler's timer
+        // takes the thread back off lock_queue
+        addToLockQueue( running, false );
+        if ( !blockUntil( deadline_ns, cancelWait, this ) )
+        {
+            return false;
+        }
+        assert( owner == running );
+    }
+
+    running->increaseLockCount();
+    return true;
+}
+
+bool Lock::cancelWait( TCB *tcb, void *arg )
+{
+    Lock *lock = static_cast<Lock *>( arg );
+    assert( tcb->getBlockedOn( ) == lock );
+
+    TCBQueue::remove( tcb );
+    lock->waiting_at[ tcb->getPriority( ) ]--;
+    tcb->setBlockedOn( nullptr );
+
+    // The owner no longer runs at tcb's priority on its behalf
+    updateInherited( lock->owner );
+    return true;
+}
+
+TCB* Lock::_unlock( )
 {
 #if DEBUG
-    std::queue<TCB *> waiting_queue_copy = waiting_queue;
-    std::cout << "[" << uthread_self( ) << "] Signaling - waiting queue: {";
+    std::cout << "[" << uthread_self( ) << "] _Unlocking" << std::endl;
+#endif
+    assert( owner == running );
+    running->decreaseLockCount();
+    if ( lock_profiling && profile != nullptr )
+    {
+        profile->released( );
+    }
+
+    if ( lock_queue.empty( ) )
+    {
+        clearOwner( );
+        return nullptr;
+    }
 
-    for ( auto iter = waiting_queue_copy.front( ); !waiting_queue_copy.empty( ); waiting_queue_copy.pop( ) )
+    // Hand the lock straight to the first waiter, it never has to compete for
+    // it again
+    TCB *next = handOff( );
+
+    if ( hoare_signalers > 0 )
     {
-        iter = waiting_queue_copy.front( );
-        std::cout << iter->getId( ) << ", ";
+        // A signalling thread is waiting to continue right away
+        hoare_signalers--;
+        return next;
     }
-    std::cout << "}" << std::endl;
+
+    next->setState( READY );
+    addToReady( next );
+    return nullptr;
+}
+
+void Lock::_signal( TCB *tcb, TCBQueue &waiters )
+{
+    // NOTE: Like before, a thread that is running because of a signal does not
+    //       signal again until the signalling thread has the lock back
+    if ( waiters.empty( ) || hoare_signalers > 0 )
+    {
+        return;
+    }
+
+    TCB *waiter = waiters.front( );
+    waiters.pop( );
+
+    if ( owner != tcb )
+    {
+        // Signalled without holding the lock, the waiter just queues up for it
+        queueForLock( waiter );
+        return;
+    }
+
+#if DEBUG
+    std::cout << "[" << uthread_self( ) << "] Signaling " << waiter->getId( ) << std::endl;
 #endif
 
-    if ( waiting_queue.empty( ) || is_signaled )
+    // The signalling thread's hold ends here and the waiter's starts in
+    // _relock(). Getting the lock back counts as a contended acquisition
+    unsigned long wait_start_ns = 0;
+    if ( lock_profiling && profile != nullptr )
+    {
+        profile->released( );
+        wait_start_ns = nowNs( );
+    }
+
+    // The waiter runs now and holds the lock. The signalling thread goes to
+    // the front of the lock queue to get it back once the waiter releases it
+    tcb->decreaseLockCount();
+    clearOwner( );
+    setOwner( waiter );
+    addToLockQueue( tcb, true );
+    hoare_signalers++;
+    updateInherited( tcb );
+    tcb->setState( BLOCK );
+    switchToThread( waiter );
+
+    // The waiter handed the lock back
+    assert( owner == tcb );
+    tcb->increaseLockCount();
+    if ( lock_profiling && profile != nullptr )
+    {
+        profile->acquired( wait_start_ns );
+    }
+}
+
+void Lock::_notify( TCBQueue &waiters )
+{
+    if ( waiters.empty( ) )
     {
         return;
     }
 
-    // Unblock the thread on the front of the waiting queue
-    TCB *queue_head = waiting_queue.front( );
-    waiting_queue.pop( );
-    
-    uthread_resume( queue_head->getId( ) );
+    TCB *waiter = waiters.front( );
+    waiters.pop( );
+    waiter->setState( READY );
+    addToReady( waiter );
+}
+
+void Lock::_relock( )
+{
+    unsigned long wait_start_ns = 0;
+    if ( owner == running )
+    {
+        // Handed over by a Hoare signal, broadcast or unlock()
+        running->increaseLockCount();
+    }
+    else
+    {
+        // Woken by a Mesa signal, the lock may have been taken in between
+        if ( lock_profiling && profile != nullptr && owner != nullptr )
+        {
+            wait_start_ns = nowNs( );
+        }
+        _lock( );
+    }
+
+    // The wait on the condition variable released the lock through _unlock()
+    if ( lock_profiling && profile != nullptr )
+    {
+        profile->acquired( wait_start_ns );
+    }
+}
 
-    signaling_thread = tcb;
-    is_signaled = true;
+void Lock::_broadcast( TCBQueue &waiters )
+{
+    if ( waiters.empty( ) )
+    {
+        return;
+    }
+
+    // The waiters now wait for the lock like threads blocked in lock(). They
+    // go behind any signalling thread waiting to get the lock back
+    for ( TCB *waiter = waiters.front( ); waiter != nullptr; waiter = waiters.next( waiter ) )
+    {
+        waiting_at[ waiter->getPriority( ) ]++;
+        waiter->setBlockedOn( this );
+    }
+    lock_queue.splice( waiters );
 
-    _unlock( );
-    switchToThread( queue_head );
-    lock( );
+    if ( owner == nullptr )
+    {
+        // Nobody is going to unlock, so the first waiter gets the lock now
+        TCB *next = handOff( );
+        next->setState( READY );
+        addToReady( next );
+    }
+    else
+    {
+        updateInherited( owner );
+    }
+}
 
-    is_signaled = false;
-    signaling_thread = nullptr;
+void Lock::setOwner( TCB *tcb )
+{
+    owner = tcb;
+    next_held = tcb->getHeldLocks( );
+    tcb->setHeldLocks( this );
 }
 
-void Lock::_unlock( )
+void Lock::clearOwner( )
 {
-#if DEBUG
-    std::cout << "[" << uthread_self( ) << "] _Unlocking" << std::endl;
+    // Locks are mostly released in the reverse order they were taken, so this
+    // is usually the first lock in the list
+    Lock *held = owner->getHeldLocks( );
+    if ( held == this )
+    {
+        owner->setHeldLocks( next_held );
+    }
+    else
+    {
+        while ( held->next_held != this )
+        {
+            held = held->next_held;
+        }
+        held->next_held = next_held;
+    }
+
+    owner = nullptr;
+    next_held = nullptr;
+}
+
+void Lock::queueForLock( TCB *tcb )
+{
+    if ( owner == nullptr )
+    {
+        setOwner( tcb );
+        tcb->setState( READY );
+        addToReady( tcb );
+    }
+    else
+    {
+        addToLockQueue( tcb, false );
+    }
+}
+
+void Lock::addToLockQueue( TCB *tcb, bool front )
+{
+    if ( front )
+    {
+        lock_queue.push_front( tcb );
+    }
+    else
+    {
+        lock_queue.push( tcb );
+    }
+    waiting_at[ tcb->getPriority( ) ]++;
+    tcb->setBlockedOn( this );
+
+    // The owner now runs at least at tcb's priority, and so does whatever
+    // thread the owner is blocked on in turn
+    updateInherited( owner );
+}
+
+TCB* Lock::handOff( )
+{
+    TCB *next = lock_queue.front( );
+    lock_queue.pop( );
+    waiting_at[ next->getPriority( ) ]--;
+    next->setBlockedOn( nullptr );
+
+    // The boost from the remaining waiters moves with the lock
+    TCB *prev = owner;
+    if ( prev != nullptr )
+    {
+        clearOwner( );
+    }
+    setOwner( next );
+    if ( prev != nullptr )
+    {
+        updateInherited( prev );
+    }
+    updateInherited( next );
+    return next;
+}
+
+Priority Lock::inheritedPriority( TCB *tcb )
+{
+    Priority inherited = MIN_PRIORITY;
+#if PRIORITY_INHERITANCE
+    for ( Lock *held = tcb->getHeldLocks( ); held != nullptr; held = held->next_held )
+    {
+        inherited = std::max( inherited, held->highestWaitingPrioritiy( ) );
+    }
 #endif
+    return inherited;
+}
 
-    // Release lock
-    running->decreaseLockCount();
-    atomic_value.clear();
+void Lock::updateInherited( TCB *tcb )
+{
+    Priority old_priority = tcb->getPriority( );
+    tcb->setInheritedPriority( inheritedPriority( tcb ) );
+    priorityChanged( tcb, old_priority );
 }
 
-void Lock::addToWaitingQueue( TCB *tcb )
+void priorityChanged( TCB *tcb, Priority old_priority )
 {
-    waiting_queue.push( tcb );
-    uthread_suspend( tcb->getId( ) );
+    // Walk down the chain of owners as long as the priority keeps changing
+    while ( tcb->getPriority( ) != old_priority )
+    {
+        Priority new_priority = tcb->getPriority( );
+
+        // A THROTTLED thread stays on its group's throttled queue and goes to
+        // the ready queue for its new priority when the group is released
+        if ( tcb->getState( ) == READY && TCBQueue::isQueued( tcb ) )
+        {
+            TCBQueue::remove( tcb );
+            addToReady( tcb );
+        }
+
+        Lock *lock = tcb->getBlockedOn( );
+        if ( lock == nullptr )
+        {
+            return;
+        }
+        lock->waiting_at[ old_priority ]--;
+        lock->waiting_at[ new_priority ]++;
+
+        tcb = lock->owner;
+        old_priority = tcb->getPriority( );
+        tcb->setInheritedPriority( Lock::inheritedPriority( tcb ) );
+    }
 }
 
 Priority Lock::highestWaitingPrioritiy( )
 {
-    std::queue<TCB *> waiting_queue_copy = waiting_queue;
     Priority max = MIN_PRIORITY;
 
-    for ( auto iter = waiting_queue_copy.front( ); !waiting_queue_copy.empty( ); waiting_queue_copy.pop( ) )
+    for ( int priority = MAX_PRIORITY; priority > MIN_PRIORITY; priority-- )
     {
-        iter = waiting_queue_copy.front( );
-        if ( iter->getPriority( ) > max )
+        if ( waiting_at[ priority ] > 0 )
         {
-            max = iter->getPriority( );
+            max = (Priority)priority;
+            break;
         }
     }
 #if DEBUG
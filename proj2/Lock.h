@@ -2,50 +2,136 @@
 #define LOCK_H
 
 #include "TCB.h"
-#include <queue>
+#include "TCBQueue.h"
 #include <cassert>
-#include <atomic>
+#include <chrono>
 
 #define DEBUG 0
 
-// Synchronization lock
+// Build with -DPRIORITY_INHERITANCE=0 to compare against plain FIFO handoff
+#ifndef PRIORITY_INHERITANCE
+#define PRIORITY_INHERITANCE 1
+#endif
+
+class LockProfile;
+
+// Synchronization lock. A thread holding the lock runs at the highest
+// priority of the threads blocked on it (priority inheritance), passed on
+// through chains of threads blocked on each other's locks
 class Lock {
 public:
   Lock();
 
+  // Create a lock that shows up under name in the lock profile (see
+  // uthread_profile_locks)
+  // NOTE: name is not copied and has to outlive the lock
+  Lock(const char *name);
+
+  ~Lock();
+
   // Attempt to acquire lock. Grab lock if available, otherwise thread is
   // blocked until the lock becomes available
   void lock();
 
-  // Unlock the lock. Wake up a blocked thread if any is waiting to acquire the
-  // lock and hand off the lock
+  // Like lock(), but give up once timeout has passed without getting the lock.
+  // A thread that gives up is taken off the lock's queue right away, and the
+  // owner stops inheriting its priority
+  // Return true if the lock was acquired
+  bool try_lock_for(std::chrono::nanoseconds timeout);
+
+  // Unlock the lock. If a thread is blocked on the lock, ownership is handed
+  // to the first one and it is made ready, so the lock is never free while
+  // threads are waiting for it
   void unlock();
 
 private:
-  std::atomic_flag atomic_value = ATOMIC_FLAG_INIT;
-  std::queue<TCB *> waiting_queue;
-  TCB *signaling_thread;
-  bool is_signaled = false;
+  TCB *owner = nullptr;       // Thread holding the lock, nullptr if free
+  TCBQueue lock_queue;        // Threads blocked in lock(), in FIFO order
+  int hoare_signalers = 0;    // Signalling threads at the front of lock_queue
+  int waiting_at[MAX_PRIORITY + 1] = {};  // Threads in lock_queue per priority
+  Lock *next_held = nullptr;  // Next lock held by the owner
+  LockProfile *profile = nullptr;  // Statistics of a named lock, nullptr if unnamed
+
+  // Make tcb the owner and add the lock to the locks it holds
+  void setOwner(TCB *tcb);
 
-  // Unlock the lock while interrupts have already been disabled
+  // Remove the lock from the locks the owner holds
+  void clearOwner();
+
+  // Give tcb the lock if it is free, otherwise queue it in lock_queue
   // NOTE: Assumes interrupts are disabled
-  void _unlock();
+  void queueForLock(TCB *tcb);
 
-  // Let the lock know that it should switch to this thread after the lock has
-  // been released (following Hoare semantics)
+  // Queue tcb in lock_queue, raising the priority of the owner if needed
   // NOTE: Assumes interrupts are disabled
-  void _signal(TCB *tcb);
+  void addToLockQueue(TCB *tcb, bool front);
 
-  // Add tcb to the waiting queue
-  void addToWaitingQueue(TCB *tcb);
+  // Remove the thread at the front of lock_queue and make it the owner, the
+  // lock may be free
+  // NOTE: Assumes interrupts are disabled
+  TCB* handOff();
 
-  // Find the highest priority in the waiting queue
+  // Acquire the lock while interrupts have already been disabled
+  // NOTE: Assumes interrupts are disabled
+  void _lock();
+
+  // Like _lock(), but stop waiting at deadline_ns. Return true if the lock was
+  // acquired
+  // NOTE: Assumes interrupts are disabled
+  bool _lockUntil(unsigned long deadline_ns);
+
+  // Take tcb off lock_queue when its try_lock_for() times out
+  // NOTE: Assumes interrupts are disabled
+  static bool cancelWait(TCB *tcb, void *arg);
+
+  // Unlock the lock while interrupts have already been disabled. Return the
+  // signalling thread the lock was handed back to if it has to run right away
+  // (following Hoare semantics), nullptr otherwise
+  // NOTE: Assumes interrupts are disabled
+  TCB* _unlock();
+
+  // Hand the lock to the first thread in waiters and switch to it. tcb gets
+  // the lock back as soon as that thread releases it (following Hoare
+  // semantics)
+  // NOTE: Assumes interrupts are disabled
+  void _signal(TCB *tcb, TCBQueue &waiters);
+
+  // Make the first thread in waiters ready, the calling thread keeps running
+  // (following Mesa semantics). The woken thread takes the lock again itself
+  // NOTE: Assumes interrupts are disabled
+  void _notify(TCBQueue &waiters);
+
+  // Take the lock again after waiting on a condition variable, unless it was
+  // handed over already
+  // NOTE: Assumes interrupts are disabled
+  void _relock();
+
+  // Move every thread in waiters to the back of lock_queue in one splice, so
+  // they get the lock one at a time as it is released instead of all waking
+  // up to fight over it (wait morphing)
+  // NOTE: Assumes interrupts are disabled
+  void _broadcast(TCBQueue &waiters);
+
+  // Find the highest priority of the threads blocked on the lock
   Priority highestWaitingPrioritiy( );
 
+  // Return the highest priority of the threads blocked on tcb's locks
+  static Priority inheritedPriority(TCB *tcb);
+
+  // Recompute the priority tcb inherits from the threads blocked on its locks
+  // NOTE: Assumes interrupts are disabled
+  static void updateInherited(TCB *tcb);
+
+  friend void priorityChanged(TCB *tcb, Priority old_priority);
+
   // Allow condition variable class access to Lock private members
-  // NOTE: CondVar should only use _unlock() and _signal() private functions
-  //       (should not access private variables directly)
+  // NOTE: CondVar should only use _unlock(), _relock(), _signal(), _notify()
+  //       and _broadcast() private functions (should not access private
+  //       variables directly)
   friend class CondVar;
+
+  // AdaptiveLock only reads owner to decide whether to keep waiting
+  friend class AdaptiveLock;
 };
 
 #endif // LOCK_H
@@ -0,0 +1,268 @@
+#include "LockProfile.h"
+#include "uthread_private.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+bool lock_profiling = false;
+
+static LockProfile *_profiles = nullptr;   // Every named lock, newest first
+
+LockProfile::LockProfile(const char *name)
+{
+    stats.name = name;
+    preemptDisable();
+    prev = nullptr;
+    next = _profiles;
+    if (next != nullptr)
+    {
+        next->prev = this;
+    }
+    _profiles = this;
+    preemptEnable();
+}
+
+LockProfile::~LockProfile()
+{
+    preemptDisable();
+    if (prev != nullptr)
+    {
+        prev->next = next;
+    }
+    else
+    {
+        _profiles = next;
+    }
+    if (next != nullptr)
+    {
+        next->prev = prev;
+    }
+    preemptEnable();
+}
+
+void LockProfile::acquired(unsigned long wait_start_ns)
+{
+    unsigned long now = nowNs();
+    stats.acquisitions++;
+    if (wait_start_ns != 0)
+    {
+        stats.contended++;
+        addWait(now - wait_start_ns);
+    }
+    hold_start_ns = now;
+}
+
+void LockProfile::timedOut(unsigned long wait_start_ns)
+{
+    stats.timeouts++;
+    addWait(nowNs() - wait_start_ns);
+}
+
+void LockProfile::addWait(unsigned long wait_ns)
+{
+    stats.wait_total_ns += wait_ns;
+    stats.wait_max_ns = std::max(stats.wait_max_ns, wait_ns);
+    addWaiter(running->getId(), wait_ns);
+}
+
+void LockProfile::released()
+{
+    if (hold_start_ns == 0)
+    {
+        return;
+    }
+
+    // Buckets start at 1, 4, 16, ... us
+    unsigned long usecs = (nowNs() - hold_start_ns) / 1000;
+    hold_start_ns = 0;
+    int bucket = 0;
+    while (usecs > 0 && bucket < LOCK_HOLD_BUCKETS - 1)
+    {
+        usecs >>= 2;
+        bucket++;
+    }
+    stats.hold_histogram[bucket]++;
+}
+
+void LockProfile::addWaiter(int tid, unsigned long wait_ns)
+{
+    // Space-saving top-k: a thread that is not tracked takes over the entry
+    // that waited the least, along with its totals. A thread that keeps
+    // waiting stays in, at the price of overstating the newcomers' figures
+    LockWaiter *least = &stats.top_waiters[0];
+    for (LockWaiter &waiter : stats.top_waiters)
+    {
+        if (waiter.count > 0 && waiter.tid == tid)
+        {
+            least = &waiter;
+            break;
+        }
+        if (waiter.count == 0)
+        {
+            least = &waiter;
+            break;
+        }
+        if (waiter.wait_ns < least->wait_ns)
+        {
+            least = &waiter;
+        }
+    }
+
+    least->tid = tid;
+    least->count++;
+    least->wait_ns += wait_ns;
+}
+
+int uthread_profile_locks(int enable)
+{
+    lock_profiling = enable != 0;
+    return 0;
+}
+
+// Return true if a should be printed before b
+static bool sortsBefore(const LockStats &a, const LockStats &b, LockStatsSort sort)
+{
+    switch (sort)
+    {
+    case LOCK_SORT_WAIT:
+        return a.wait_total_ns > b.wait_total_ns;
+    case LOCK_SORT_MAX_WAIT:
+        return a.wait_max_ns > b.wait_max_ns;
+    case LOCK_SORT_CONTENDED:
+        return a.contended > b.contended;
+    case LOCK_SORT_ACQUISITIONS:
+        return a.acquisitions > b.acquisitions;
+    case LOCK_SORT_NAME:
+    default:
+        return strcmp(a.name, b.name) < 0;
+    }
+}
+
+// Waiters in order of time spent waiting, longest first
+static std::vector<LockWaiter> topWaiters(const LockStats &stats)
+{
+    std::vector<LockWaiter> waiters;
+    for (const LockWaiter &waiter : stats.top_waiters)
+    {
+        if (waiter.count > 0)
+        {
+            waiters.push_back(waiter);
+        }
+    }
+    std::sort(waiters.begin(), waiters.end(),
+              [](const LockWaiter &a, const LockWaiter &b) { return a.wait_ns > b.wait_ns; });
+    return waiters;
+}
+
+static const char* _bucket_names[LOCK_HOLD_BUCKETS] = {
+    "<1us", "<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", ">=4ms"
+};
+
+static void printTable(FILE *out, const std::vector<LockStats> &profiles)
+{
+    fprintf(out, "%-24s %12s %10s %6s %8s %12s %10s %10s  %-48s %s\n", "lock", "acquisitions",
+            "contended", "%", "timeouts", "wait ms", "avg us", "max us", "top waiters (tid:ms)",
+            "holds");
+    for (const LockStats &stats : profiles)
+    {
+        double percent = stats.acquisitions == 0 ? 0 : 100.0 * stats.contended / stats.acquisitions;
+        unsigned long waits = stats.contended + stats.timeouts;
+        double avg_us = waits == 0 ? 0 : stats.wait_total_ns / 1000.0 / waits;
+        fprintf(out, "%-24s %12lu %10lu %6.1f %8lu %12.3f %10.1f %10.1f  ", stats.name,
+                stats.acquisitions, stats.contended, percent, stats.timeouts,
+                stats.wait_total_ns / 1e6, avg_us, stats.wait_max_ns / 1000.0);
+
+        char waiters[64] = "-";
+        int length = 0;
+        for (const LockWaiter &waiter : topWaiters(stats))
+        {
+            length += snprintf(waiters + length, sizeof(waiters) - length, "%s%d:%.3f",
+                               length == 0 ? "" : " ", waiter.tid, waiter.wait_ns / 1e6);
+            if (length >= (int)sizeof(waiters))
+            {
+                break;
+            }
+        }
+        fprintf(out, "%-48s", waiters);
+
+        // Only the buckets with holds in them
+        bool first = true;
+        for (int i = 0; i < LOCK_HOLD_BUCKETS; i++)
+        {
+            if (stats.hold_histogram[i] > 0)
+            {
+                fprintf(out, "%s%s:%lu", first ? " " : ",", _bucket_names[i], stats.hold_histogram[i]);
+                first = false;
+            }
+        }
+        fprintf(out, first ? " -\n" : "\n");
+    }
+}
+
+static void printCsv(FILE *out, const std::vector<LockStats> &profiles)
+{
+    fprintf(out, "lock,acquisitions,contended,timeouts,wait_ns,max_wait_ns");
+    for (int i = 0; i < LOCK_HOLD_BUCKETS; i++)
+    {
+        fprintf(out, ",hold%s", _bucket_names[i]);
+    }
+    fprintf(out, ",top_waiters\n");
+
+    for (const LockStats &stats : profiles)
+    {
+        fprintf(out, "%s,%lu,%lu,%lu,%lu,%lu", stats.name, stats.acquisitions,
+                stats.contended, stats.timeouts, stats.wait_total_ns, stats.wait_max_ns);
+        for (int i = 0; i < LOCK_HOLD_BUCKETS; i++)
+        {
+            fprintf(out, ",%lu", stats.hold_histogram[i]);
+        }
+
+        // tid:wait_ns pairs separated by spaces, so the field needs no quoting
+        fprintf(out, ",");
+        bool first = true;
+        for (const LockWaiter &waiter : topWaiters(stats))
+        {
+            fprintf(out, "%s%d:%lu", first ? "" : " ", waiter.tid, waiter.wait_ns);
+            first = false;
+        }
+        fprintf(out, "\n");
+    }
+}
+
+int uthread_dump_lock_stats(FILE *out, LockStatsFormat format, LockStatsSort sort)
+{
+    if (out == nullptr || (format != LOCK_STATS_TABLE && format != LOCK_STATS_CSV))
+    {
+        return -1;
+    }
+
+    // Copy the statistics so the locks can keep running (or go away) while
+    // they are printed
+    std::vector<LockStats> profiles;
+    preemptDisable();
+    for (LockProfile *profile = _profiles; profile != nullptr; profile = profile->next)
+    {
+        profiles.push_back(profile->stats);
+    }
+    preemptEnable();
+
+    std::stable_sort(profiles.begin(), profiles.end(),
+                     [sort](const LockStats &a, const LockStats &b) { return sortsBefore(a, b, sort); });
+
+    if (format == LOCK_STATS_TABLE)
+    {
+        printTable(out, profiles);
+    }
+    else
+    {
+        printCsv(out, profiles);
+    }
+    fflush(out);
+    return 0;
+}
+
+void reportLockStats()
+{
+    fprintf(stderr, "uthread lock profile:\n");
+    uthread_dump_lock_stats(stderr, LOCK_STATS_TABLE, LOCK_SORT_WAIT);
+}
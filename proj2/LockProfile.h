@@ -0,0 +1,80 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include "uthread.h"
+
+#define LOCK_HOLD_BUCKETS 8   /* hold-time histogram buckets, x4 wider each */
+#define LOCK_TOP_WAITERS 4    /* threads tracked per lock by time spent waiting */
+
+// True while lock profiling is on. Locks only look at their profile when it
+// is set, so an unprofiled acquisition costs one predictable branch
+extern bool lock_profiling;
+
+// Thread among the ones that waited the longest for a lock. An entry taken
+// over from another thread keeps its totals, so it can overstate them
+struct LockWaiter {
+  int tid;
+  unsigned long count;      // Contended acquisitions and timeouts
+  unsigned long wait_ns;    // Total time spent waiting
+};
+
+// Contention statistics of one named lock
+struct LockStats {
+  const char *name;
+  unsigned long acquisitions;
+  unsigned long contended;              // Acquisitions that had to wait
+  unsigned long timeouts;               // try_lock_for waits that gave up
+  unsigned long wait_total_ns;
+  unsigned long wait_max_ns;
+  unsigned long hold_histogram[LOCK_HOLD_BUCKETS];  // [0, 1 us), [1, 4 us), [4, 16 us), ...
+  LockWaiter top_waiters[LOCK_TOP_WAITERS];         // Unused entries have count 0
+};
+
+// Statistics kept for a named lock. Only the thread holding the lock, or one
+// giving up on it with interrupts disabled, updates them, so they need no
+// locking of their own
+// NOTE: Profiles are on a list of every named lock, which is only changed with
+//       preemption disabled
+class LockProfile {
+public:
+  // Add a profile for the lock called name to the list
+  // NOTE: name is not copied and has to outlive the lock
+  LockProfile(const char *name);
+
+  // Remove the profile from the list
+  ~LockProfile();
+
+  LockProfile(const LockProfile &) = delete;
+  LockProfile& operator=(const LockProfile &) = delete;
+
+  // Count an acquisition by the running thread that started waiting at
+  // wait_start_ns, 0 if it got the lock right away, and start timing the hold
+  void acquired(unsigned long wait_start_ns);
+
+  // Stop timing the hold, if it was timed
+  void released();
+
+  // Count a wait by the running thread that started at wait_start_ns and
+  // timed out without getting the lock
+  void timedOut(unsigned long wait_start_ns);
+
+private:
+  LockStats stats = {};
+  unsigned long hold_start_ns = 0;  // When the current hold started, 0 if not timed
+  LockProfile *next;                // Next profile on the list
+  LockProfile *prev;
+
+  // Add wait_ns to the wait totals and to the running thread in top_waiters
+  void addWait(unsigned long wait_ns);
+
+  // Charge wait_ns to tid in top_waiters
+  void addWaiter(int tid, unsigned long wait_ns);
+
+  friend int uthread_dump_lock_stats(FILE *out, LockStatsFormat format, LockStatsSort sort);
+};
+
+// Print every named lock's statistics to stderr, sorted by total wait
+// NOTE: Registered with atexit when UTHREAD_LOCK_PROFILE is set
+void reportLockStats();
+
+#endif // LOCK_PROFILE_H
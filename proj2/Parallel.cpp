@@ -0,0 +1,211 @@
+#include "Parallel.h"
+#include "uthread_private.h"
+#include <cassert>
+#include <new>
+
+namespace uthread {
+
+namespace detail {
+
+// Ranges waiting to be run by one worker. The owner pushes and pops at the
+// bottom, thieves take from the top, so the owner works depth first on small
+// ranges while thieves carry off the big ones
+// NOTE: Only touched with preemption disabled
+struct WorkDeque
+{
+    range ranges[PARALLEL_DEQUE_SIZE];
+    int top = 0;
+    int bottom = 0;
+};
+
+// State of one parallel_for/parallel_reduce call
+struct Region
+{
+    chunk_fn fn;
+    void *ctx;
+    long grain;
+    volatile long remaining;  // Indices not yet run
+    int workers;
+    WorkDeque deques[PARALLEL_WORKERS_MAX];
+};
+
+struct WorkerArg
+{
+    Region *region;
+    int index;
+};
+
+} // namespace detail
+
+using namespace detail;
+
+static int _parallel_workers = PARALLEL_WORKERS;
+
+int set_parallel_workers(int workers)
+{
+    if (workers < 1 || workers > PARALLEL_WORKERS_MAX)
+    {
+        return -1;
+    }
+    _parallel_workers = workers;
+    return 0;
+}
+
+int get_parallel_workers()
+{
+    return _parallel_workers;
+}
+
+static bool popBottom(WorkDeque &deque, range &r)
+{
+    preemptDisable();
+    bool found = deque.bottom > deque.top;
+    if (found)
+    {
+        r = deque.ranges[--deque.bottom];
+        if (deque.bottom == deque.top)
+        {
+            deque.bottom = deque.top = 0;
+        }
+    }
+    preemptEnable();
+    return found;
+}
+
+static bool stealTop(WorkDeque &deque, range &r)
+{
+    preemptDisable();
+    bool found = deque.bottom > deque.top;
+    if (found)
+    {
+        r = deque.ranges[deque.top++];
+        if (deque.bottom == deque.top)
+        {
+            deque.bottom = deque.top = 0;
+        }
+    }
+    preemptEnable();
+    return found;
+}
+
+static void pushBottom(WorkDeque &deque, range r)
+{
+    preemptDisable();
+    // Halving from the whole range never queues more than one range per
+    // level, and 64 levels cover any long range
+    assert(deque.bottom < PARALLEL_DEQUE_SIZE);
+    deque.ranges[deque.bottom++] = r;
+    preemptEnable();
+}
+
+// Split r down to the grain, queueing the upper halves, then run what is left
+static void runRange(Region *region, int index, range r)
+{
+    WorkDeque &deque = region->deques[index];
+    while (r.size() > region->grain)
+    {
+        long middle = r.begin + r.size() / 2;
+        pushBottom(deque, { middle, r.end });
+        r.end = middle;
+    }
+
+    region->fn(region->ctx, r, index);
+
+    preemptDisable();
+    region->remaining -= r.size();
+    preemptEnable();
+}
+
+// Run queued ranges until every index of the region has been run
+static void workLoop(Region *region, int index)
+{
+    range r;
+    while (region->remaining > 0)
+    {
+        if (popBottom(region->deques[index], r))
+        {
+            runRange(region, index, r);
+            continue;
+        }
+
+        // Out of work, try the other workers in order
+        bool stolen = false;
+        for (int i = 1; i < region->workers && !stolen; i++)
+        {
+            stolen = stealTop(region->deques[(index + i) % region->workers], r);
+        }
+
+        if (stolen)
+        {
+            runRange(region, index, r);
+        }
+        else if (region->remaining > 0)
+        {
+            // What is left is being run by another worker
+            uthread_yield();
+        }
+    }
+}
+
+static void* worker(void *arg)
+{
+    WorkerArg *worker_arg = (WorkerArg *)arg;
+    workLoop(worker_arg->region, worker_arg->index);
+    return nullptr;
+}
+
+namespace detail {
+
+int run_parallel(range r, long grain, int workers, chunk_fn fn, void *ctx)
+{
+    if (r.size() <= 0)
+    {
+        return 1;
+    }
+
+    void *memory = uthread_malloc(sizeof(Region));
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    Region *region = new (memory) Region();
+    region->fn = fn;
+    region->ctx = ctx;
+    region->grain = grain < 1 ? 1 : grain;
+    region->remaining = r.size();
+    region->workers = workers;
+
+    // The whole range starts on the calling thread's deque, helpers start
+    // out by stealing from it
+    pushBottom(region->deques[0], r);
+
+    WorkerArg args[PARALLEL_WORKERS_MAX];
+    void *arg_ptrs[PARALLEL_WORKERS_MAX];
+    int tids[PARALLEL_WORKERS_MAX];
+    for (int i = 1; i < workers; i++)
+    {
+        args[i] = { region, i };
+        arg_ptrs[i] = &args[i];
+    }
+
+    // Without helper threads the calling thread runs everything itself
+    if (workers > 1 && uthread_create_many(workers - 1, worker, arg_ptrs + 1, tids + 1) != 0)
+    {
+        region->workers = workers = 1;
+    }
+
+    workLoop(region, 0);
+
+    for (int i = 1; i < workers; i++)
+    {
+        uthread_join(tids[i], nullptr);
+    }
+
+    region->~Region();
+    uthread_free(region);
+    return workers;
+}
+
+} // namespace detail
+
+} // namespace uthread
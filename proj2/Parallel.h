@@ -0,0 +1,99 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "uthread.h"
+#include "Allocator.h"
+#include <utility>
+#include <vector>
+
+#define PARALLEL_WORKERS 4      /* default worker threads per parallel call */
+#define PARALLEL_WORKERS_MAX 16 /* most worker threads per parallel call */
+#define PARALLEL_DEQUE_SIZE 64  /* split ranges a worker can have queued */
+
+namespace uthread {
+
+// Half-open range of loop indices [begin, end)
+struct range {
+  long begin;
+  long end;
+
+  long size() const { return end - begin; }
+};
+
+// Set how many threads (including the caller) run each parallel_for and
+// parallel_reduce, between 1 and PARALLEL_WORKERS_MAX. If the helper threads
+// cannot be created, the caller runs the whole range by itself
+// Return 0 on success, -1 on failure
+int set_parallel_workers(int workers);
+
+// Return the number of threads each parallel call runs on
+int get_parallel_workers();
+
+namespace detail {
+
+// Run a chunk of the range on worker number `worker`
+typedef void (*chunk_fn)(void *ctx, range chunk, int worker);
+
+// Split r into chunks of at most grain indices and run them on the calling
+// thread and up to workers - 1 helper threads. Every worker splits its own
+// ranges in half and keeps the upper half on its deque, idle workers steal
+// the oldest (largest) range from another worker's deque
+// Return the number of workers that took part
+int run_parallel(range r, long grain, int workers, chunk_fn fn, void *ctx);
+
+template <typename F>
+struct ForContext {
+  F &body;
+
+  static void run(void *ctx, range chunk, int)
+  {
+    static_cast<ForContext *>(ctx)->body(chunk);
+  }
+};
+
+template <typename T, typename F>
+struct ReduceContext {
+  F &body;
+  std::vector<T, UthreadAllocator<T> > partials;  // Running result of every worker
+
+  static void run(void *ctx, range chunk, int worker)
+  {
+    ReduceContext *self = static_cast<ReduceContext *>(ctx);
+    self->partials[worker] = self->body(chunk, std::move(self->partials[worker]));
+  }
+};
+
+} // namespace detail
+
+// Call body(chunk) for chunks of r of at most grain indices each, on several
+// threads, and return once every chunk is done. Chunks run as plain calls on
+// the worker threads, not as threads of their own
+template <typename F>
+void parallel_for(range r, long grain, F &&body)
+{
+  detail::ForContext<F> ctx = { body };
+  detail::run_parallel(r, grain, get_parallel_workers(), detail::ForContext<F>::run, &ctx);
+}
+
+// Fold the chunks of r into a single value. Every worker starts from identity
+// and folds its chunks with acc = body(chunk, acc), then the partial results
+// are combined with reduce(a, b)
+// NOTE: reduce must be associative, chunks are folded in no particular order
+template <typename T, typename F, typename R>
+T parallel_reduce(range r, long grain, const T &identity, F &&body, R &&reduce)
+{
+  int workers = get_parallel_workers();
+  detail::ReduceContext<T, F> ctx = { body, std::vector<T, UthreadAllocator<T> >(workers, identity) };
+  int used = detail::run_parallel(r, grain, workers, detail::ReduceContext<T, F>::run, &ctx);
+
+  T result = std::move(ctx.partials[0]);
+  for (int i = 1; i < used; i++)
+  {
+    result = reduce(std::move(result), std::move(ctx.partials[i]));
+  }
+  return result;
+}
+
+} // namespace uthread
+
+#endif // PARALLEL_H
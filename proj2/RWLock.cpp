@@ -0,0 +1,193 @@
+#include "RWLock.h"
+#include "uthread_private.h"
+#include <cassert>
+
+RWLock::RWLock(bool prefer_writers) : prefer_writers(prefer_writers)
+{
+    return;
+}
+
+bool RWLock::readerMustWait( ) const
+{
+    return writer != nullptr || upgrader != nullptr ||
+           ( prefer_writers && !write_queue.empty( ) );
+}
+
+void RWLock::lock_shared( )
+{
+    // Uncontended case, only keep the timer from switching threads in between
+    preemptDisable( );
+    if ( !readerMustWait( ) && !schedule_tracing )
+    {
+        readers++;
+        running->increaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    if ( readerMustWait( ) )
+    {
+        // Sleep until a writer lets all readers in, already counted
+        read_queue.push( running );
+        running->setState( BLOCK );
+        switchThreads( );
+    }
+    else
+    {
+        readers++;
+    }
+    running->increaseLockCount();
+    enableInterrupts( );
+}
+
+void RWLock::unlock_shared( )
+{
+    preemptDisable( );
+    if ( readers > 1 && upgrader == nullptr && !schedule_tracing )
+    {
+        // Other readers are still in, nobody can be waiting for this one
+        readers--;
+        running->decreaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    assert( readers > 0 );
+    readers--;
+    running->decreaseLockCount();
+    wakeWaiters( );
+    enableInterrupts( );
+}
+
+void RWLock::lock( )
+{
+    preemptDisable( );
+    if ( writer == nullptr && readers == 0 && upgrader == nullptr && !schedule_tracing )
+    {
+        writer = running;
+        running->increaseLockCount();
+        preemptEnable( );
+        return;
+    }
+    preemptEnable( );
+
+    disableInterrupts( );
+    if ( writer == nullptr && readers == 0 && upgrader == nullptr )
+    {
+        writer = running;
+    }
+    else
+    {
+        // Sleep until the lock is handed over
+        assert( writer != running );
+        write_queue.push( running );
+        running->setState( BLOCK );
+        switchThreads( );
+        assert( writer == running );
+    }
+    running->increaseLockCount();
+    enableInterrupts( );
+}
+
+void RWLock::unlock( )
+{
+    disableInterrupts( );
+    assert( writer == running );
+    writer = nullptr;
+    running->decreaseLockCount();
+    wakeWaiters( );
+    enableInterrupts( );
+}
+
+bool RWLock::upgrade( )
+{
+    disableInterrupts( );
+    assert( readers > 0 && writer == nullptr );
+    if ( upgrader != nullptr )
+    {
+        enableInterrupts( );
+        return false;
+    }
+
+    if ( readers > 1 )
+    {
+        // Hold on to the shared hold until the last other reader leaves and
+        // hands over the lock
+        upgrader = running;
+        running->setState( BLOCK );
+        switchThreads( );
+        assert( writer == running );
+    }
+    else
+    {
+        readers = 0;
+        writer = running;
+    }
+    enableInterrupts( );
+    return true;
+}
+
+void RWLock::downgrade( )
+{
+    disableInterrupts( );
+    assert( writer == running );
+    writer = nullptr;
+    readers = 1;
+
+    // Readers that only waited for this writer can come in too
+    if ( !( prefer_writers && !write_queue.empty( ) ) )
+    {
+        grantReaders( );
+    }
+    enableInterrupts( );
+}
+
+void RWLock::wakeWaiters( )
+{
+    if ( upgrader != nullptr )
+    {
+        // The upgrader's own shared hold is the last one left
+        if ( readers == 1 )
+        {
+            readers = 0;
+            writer = upgrader;
+            upgrader = nullptr;
+            writer->setState( READY );
+            addToReady( writer );
+        }
+        return;
+    }
+
+    if ( readers > 0 )
+    {
+        return;
+    }
+
+    // With writer preference the next writer goes before waiting readers
+    bool next_is_writer = !write_queue.empty( ) &&
+                          ( prefer_writers || read_queue.empty( ) );
+    if ( next_is_writer )
+    {
+        writer = write_queue.front( );
+        write_queue.pop( );
+        writer->setState( READY );
+        addToReady( writer );
+    }
+    else
+    {
+        grantReaders( );
+    }
+}
+
+void RWLock::grantReaders( )
+{
+    for ( TCB *reader = read_queue.front( ); reader != nullptr; reader = read_queue.next( reader ) )
+    {
+        readers++;
+    }
+    addAllToReady( read_queue );
+}
@@ -0,0 +1,63 @@
+#ifndef RW_LOCK_H
+#define RW_LOCK_H
+
+#include "TCB.h"
+#include "TCBQueue.h"
+
+// Synchronization reader-writer lock. Any number of threads can hold it
+// shared, or a single thread exclusively
+class RWLock {
+public:
+  // With prefer_writers, new readers wait while a writer is waiting, so a
+  // steady stream of readers cannot starve writers. Otherwise waiting
+  // readers go first and writers wait for a moment without readers
+  RWLock(bool prefer_writers = true);
+
+  // Acquire the lock shared. The thread is blocked while a writer holds the
+  // lock (or is waiting, with writer preference)
+  void lock_shared();
+
+  // Release a shared hold. The last reader out hands the lock to a waiting
+  // upgrader or writer
+  void unlock_shared();
+
+  // Acquire the lock exclusively. The thread is blocked until no other
+  // thread holds the lock
+  void lock();
+
+  // Release the exclusive hold. Either the next writer gets the lock or all
+  // waiting readers are let in together, made ready in one step
+  void unlock();
+
+  // Turn the calling thread's shared hold into an exclusive one, waiting for
+  // the other readers to leave. Only one reader can be upgrading at a time,
+  // since two would wait for each other
+  // Return true on success, false if another reader is already upgrading (the
+  // shared hold is kept)
+  bool upgrade();
+
+  // Turn the calling thread's exclusive hold into a shared one, letting the
+  // waiting readers in with it
+  void downgrade();
+
+private:
+  bool prefer_writers;
+  int readers = 0;            // Threads holding the lock shared
+  TCB *writer = nullptr;      // Thread holding the lock exclusively
+  TCB *upgrader = nullptr;    // Reader waiting in upgrade()
+  TCBQueue read_queue;        // Threads blocked in lock_shared()
+  TCBQueue write_queue;       // Threads blocked in lock(), in FIFO order
+
+  // Return true if a thread calling lock_shared() has to wait
+  bool readerMustWait() const;
+
+  // Pass the lock on after the last holder left
+  // NOTE: Assumes interrupts are disabled
+  void wakeWaiters();
+
+  // Let every waiting reader in, made ready in one step
+  // NOTE: Assumes interrupts are disabled
+  void grantReaders();
+};
+
+#endif // RW_LOCK_H
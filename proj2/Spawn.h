@@ -0,0 +1,77 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include "uthread.h"
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace uthread {
+
+namespace detail {
+
+// A callable and its arguments, constructed at the top of the new thread's
+// stack. run() is the thread function stub() calls with the closure address
+template <typename F, typename... Args>
+struct SpawnClosure {
+  typedef std::tuple<typename std::decay<Args>::type...> ArgTuple;
+
+  F fn;
+  ArgTuple args;
+
+  template <typename G, typename Tuple>
+  SpawnClosure(G &&g, Tuple &&t) : fn(std::forward<G>(g)), args(std::forward<Tuple>(t)) {}
+
+  template <size_t... I>
+  void invoke(std::index_sequence<I...>)
+  {
+    fn(std::move(std::get<I>(args))...);
+  }
+
+  static void* run(void *buffer)
+  {
+    SpawnClosure *closure = static_cast<SpawnClosure *>(buffer);
+    closure->invoke(std::index_sequence_for<Args...>());
+    closure->~SpawnClosure();
+    return nullptr;
+  }
+};
+
+// References to spawn()'s parameters, valid while uthread_create_with_stack_arg
+// constructs the closure
+template <typename F, typename... Args>
+struct SpawnRefs {
+  F &&fn;
+  std::tuple<Args &&...> args;
+};
+
+template <typename Closure, typename Refs>
+void construct_closure(void *buffer, void *refs_ptr)
+{
+  Refs *refs = static_cast<Refs *>(refs_ptr);
+  new (buffer) Closure(std::forward<decltype(refs->fn)>(refs->fn), std::move(refs->args));
+}
+
+} // namespace detail
+
+// Create a new thread that runs fn(args...). The callable and copies of the
+// arguments are placed at the top of the new thread's stack, so capturing
+// lambdas need no heap allocation beyond the stack itself
+// NOTE: The closure is not destroyed if the thread calls uthread_exit
+// Return new thread ID on success, -1 on failure
+template <typename F, typename... Args>
+int spawn(F &&fn, Args &&... args)
+{
+  typedef detail::SpawnClosure<typename std::decay<F>::type, Args...> Closure;
+  typedef detail::SpawnRefs<F, Args...> Refs;
+  static_assert(alignof(Closure) <= 16, "closure is over-aligned");
+
+  Refs refs = { std::forward<F>(fn), std::forward_as_tuple(std::forward<Args>(args)...) };
+  return uthread_create_with_stack_arg(Closure::run, sizeof(Closure),
+                                       detail::construct_closure<Closure, Refs>, &refs);
+}
+
+} // namespace uthread
+
+#endif // SPAWN_H
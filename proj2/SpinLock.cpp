@@ -1,5 +1,18 @@
 #include "SpinLock.h"
+#include "LockProfile.h"
 #include "uthread_private.h"
+#include <new>
+
+// Tell the CPU this is a spin-wait loop, which saves power and avoids the
+// memory-order mis-speculation penalty when the loop exits
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
 
 SpinLock::SpinLock()
 {
@@ -7,6 +20,25 @@ SpinLock::SpinLock()
     return;
 }
 
+SpinLock::SpinLock(const char *name)
+{
+    void *memory = uthread_malloc(sizeof(LockProfile));
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    profile = new (memory) LockProfile(name);
+}
+
+SpinLock::~SpinLock()
+{
+    if (profile != nullptr)
+    {
+        profile->~LockProfile();
+        uthread_free(profile);
+    }
+}
+
 void SpinLock::lock()
 {
     /*
@@ -19,13 +51,198 @@ void SpinLock::lock()
     2. If the lock is not available (1), then test_and_set continually returns 1 and
     thread spins until thread holding the lock releases it (atomic_value.clear())
     */
+    if (lock_profiling && profile != nullptr)
+    {
+        // Only time the wait if the lock is taken
+        unsigned long wait_start_ns = 0;
+        if (atomic_value.test_and_set())
+        {
+            wait_start_ns = nowNs();
+            while(atomic_value.test_and_set());
+        }
+        running->increaseLockCount();
+        profile->acquired(wait_start_ns);
+        return;
+    }
+
     while(atomic_value.test_and_set());
     running->increaseLockCount();
 }
 
 void SpinLock::unlock()
 {
+    if (lock_profiling && profile != nullptr)
+    {
+        profile->released();
+    }
+
     // Makes lock available to other threads (set atomic_value to 0)
     atomic_value.clear();
     running->decreaseLockCount();
-}
\ No newline at end of file
+}
+
+TTASSpinLock::TTASSpinLock() : locked(false)
+{
+    return;
+}
+
+void TTASSpinLock::lock()
+{
+    int backoff = SPIN_BACKOFF_MIN;
+    while (true)
+    {
+        // Only try to take the lock once it looks free, reading does not
+        // steal the cache line from the holder
+        while (locked.load(std::memory_order_relaxed))
+        {
+            cpuRelax();
+        }
+        if (!locked.exchange(true, std::memory_order_acquire))
+        {
+            break;
+        }
+
+        // Somebody else got it first, wait longer before the next try
+        for (int i = 0; i < backoff; i++)
+        {
+            cpuRelax();
+        }
+        if (backoff < SPIN_BACKOFF_MAX)
+        {
+            backoff *= 2;
+        }
+    }
+    running->increaseLockCount();
+}
+
+void TTASSpinLock::unlock()
+{
+    locked.store(false, std::memory_order_release);
+    running->decreaseLockCount();
+}
+
+TicketSpinLock::TicketSpinLock() : next_ticket(0), now_serving(0)
+{
+    return;
+}
+
+void TicketSpinLock::lock()
+{
+    unsigned int ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+    while (true)
+    {
+        unsigned int serving = now_serving.load(std::memory_order_acquire);
+        if (serving == ticket)
+        {
+            break;
+        }
+
+        // Back off in proportion to the number of threads ahead
+        for (unsigned int i = 0; i < (ticket - serving) * SPIN_BACKOFF_MIN; i++)
+        {
+            cpuRelax();
+        }
+    }
+    running->increaseLockCount();
+}
+
+void TicketSpinLock::unlock()
+{
+    // Only the holder writes now_serving
+    now_serving.store(now_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    running->decreaseLockCount();
+}
+
+MCSSpinLock::MCSSpinLock() : tail(nullptr)
+{
+    holder.next.store(nullptr, std::memory_order_relaxed);
+    holder.waiting.store(false, std::memory_order_relaxed);
+}
+
+void MCSSpinLock::lock()
+{
+    // The lock's own node stands in for the holder's, so the holder needs no
+    // node of its own once it has the lock
+    Node *self = &holder;
+
+    while (true)
+    {
+        Node *prev = tail.load(std::memory_order_relaxed);
+        if (prev == nullptr)
+        {
+            Node *expected = nullptr;
+            if (tail.compare_exchange_strong(expected, self, std::memory_order_acquire))
+            {
+                break;
+            }
+            continue;
+        }
+
+        Node node;
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.waiting.store(true, std::memory_order_relaxed);
+
+        // Being preempted between joining the queue and linking in would keep
+        // the holder spinning for its successor
+        preemptDisable();
+        if (!tail.compare_exchange_strong(prev, &node, std::memory_order_acq_rel))
+        {
+            preemptEnable();
+            continue;
+        }
+        prev->next.store(&node, std::memory_order_release);
+        preemptEnable();
+
+        while (node.waiting.load(std::memory_order_acquire))
+        {
+            cpuRelax();
+        }
+
+        // Move the node's successor over to the lock before the node goes away
+        preemptDisable();
+        Node *succ = node.next.load(std::memory_order_acquire);
+        if (succ == nullptr)
+        {
+            holder.next.store(nullptr, std::memory_order_relaxed);
+            Node *expected = &node;
+            if (!tail.compare_exchange_strong(expected, self, std::memory_order_acq_rel))
+            {
+                // A thread queued up behind this one and is linking in
+                while ((succ = node.next.load(std::memory_order_acquire)) == nullptr)
+                {
+                    cpuRelax();
+                }
+                holder.next.store(succ, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            holder.next.store(succ, std::memory_order_relaxed);
+        }
+        preemptEnable();
+        break;
+    }
+    running->increaseLockCount();
+}
+
+void MCSSpinLock::unlock()
+{
+    Node *succ = holder.next.load(std::memory_order_acquire);
+    if (succ == nullptr)
+    {
+        Node *expected = &holder;
+        if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_release))
+        {
+            running->decreaseLockCount();
+            return;
+        }
+
+        // A waiter is linking itself in
+        while ((succ = holder.next.load(std::memory_order_acquire)) == nullptr)
+        {
+            cpuRelax();
+        }
+    }
+    succ->waiting.store(false, std::memory_order_release);
+    running->decreaseLockCount();
+}
@@ -3,11 +3,23 @@
 
 #include <atomic>
 
+class LockProfile;
+
+#define SPIN_BACKOFF_MIN 4      /* pause instructions after a first failed attempt */
+#define SPIN_BACKOFF_MAX 1024   /* most pause instructions between attempts */
+
 // Synchronization spinlock
 class SpinLock {
 public:
   SpinLock();
 
+  // Create a spinlock that shows up under name in the lock profile (see
+  // uthread_profile_locks)
+  // NOTE: name is not copied and has to outlive the lock
+  SpinLock(const char *name);
+
+  ~SpinLock();
+
   // Acquire the lock. Spin until the lock is acquired if the lock is already
   // held
   void lock();
@@ -17,6 +29,72 @@ public:
 
 private:
   std::atomic_flag atomic_value = ATOMIC_FLAG_INIT;   // Test-and-Set variable
+  LockProfile *profile = nullptr;   // Statistics of a named spinlock, nullptr if unnamed
+};
+
+// Test-and-test-and-set spinlock. Waiters spin reading the flag, which stays in
+// their cache until the holder releases it, and only then try to set it. After
+// a failed attempt they back off for exponentially longer, so a release is not
+// followed by every waiter writing the flag at once
+class TTASSpinLock {
+public:
+  TTASSpinLock();
+
+  // Acquire the lock. Spin until the lock is acquired if the lock is already
+  // held
+  void lock();
+
+  // Unlock the lock
+  void unlock();
+
+private:
+  std::atomic<bool> locked;
+};
+
+// Ticket spinlock. Threads get the lock in the order they asked for it, so no
+// waiter can be overtaken forever
+// NOTE: On a single kernel thread a preempted waiter holds up every waiter
+//       behind it, the lock is handed to it only once it runs again
+class TicketSpinLock {
+public:
+  TicketSpinLock();
+
+  // Acquire the lock. Spin until the lock is acquired if the lock is already
+  // held
+  void lock();
+
+  // Unlock the lock
+  void unlock();
+
+private:
+  std::atomic<unsigned int> next_ticket;   // Ticket of the next thread to ask
+  std::atomic<unsigned int> now_serving;   // Ticket of the thread holding the lock
+};
+
+// MCS queue spinlock. Waiters queue up in FIFO order and each one spins on its
+// own queue node, so a release only touches the cache line of the next waiter
+// NOTE: Nodes live on the waiting thread's stack while it waits (the K42
+//       variant), so lock() and unlock() need no node argument. Like
+//       TicketSpinLock, a preempted waiter holds up the ones behind it
+class MCSSpinLock {
+public:
+  MCSSpinLock();
+
+  // Acquire the lock. Spin until the lock is acquired if the lock is already
+  // held
+  void lock();
+
+  // Unlock the lock
+  void unlock();
+
+  struct Node {
+    std::atomic<Node*> next;
+    std::atomic<bool> waiting;
+  };
+
+private:
+  std::atomic<Node*> tail;    // Last thread in the queue, nullptr if the lock is free
+  Node holder;                // Stands in for the holder's node, holder.next is the first waiter
 };
 
 #endif // SPIN_LOCK_H
@@ -3,36 +3,148 @@
  */
 
 #include "TCB.h"
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
 
-TCB::TCB(int tid, void *(*start_routine)(void* arg), void *arg, State state): _tid(tid), _quantum(0), _state(state), _lock_count(0), _priority(DEFAULT_PRIORITY)
+// Free TCB blocks, linked through their first word
+static void* _free_tcbs = nullptr;
+
+void* TCB::operator new(size_t size)
+{
+        assert(size == sizeof(TCB));
+
+        // Carve a new slab into free blocks when we run out
+        if (_free_tcbs == nullptr)
+        {
+                void* slab;
+                if (posix_memalign(&slab, CACHE_LINE_SIZE, sizeof(TCB) * TCB_SLAB_COUNT) != 0)
+                {
+                        throw std::bad_alloc();
+                }
+                for (int i = 0; i < TCB_SLAB_COUNT; i++)
+                {
+                        void* block = (char*)slab + i * sizeof(TCB);
+                        *(void**)block = _free_tcbs;
+                        _free_tcbs = block;
+                }
+        }
+
+        void* block = _free_tcbs;
+        _free_tcbs = *(void**)block;
+        return block;
+}
+
+void TCB::operator delete(void* ptr)
+{
+        // Slabs are never returned, their blocks are reused for new TCBs
+        *(void**)ptr = _free_tcbs;
+        _free_tcbs = ptr;
+}
+
+// Stacks of deleted threads kept around for new threads
+static char* _stack_cache[STACK_CACHE_SIZE];
+static int _cached_stacks = 0;
+
+// Paint new stacks so their high-water mark can be found
+static bool _paint_stacks = false;
+
+static char* allocateStack()
+{
+        if (_cached_stacks > 0)
+        {
+                return _stack_cache[--_cached_stacks];
+        }
+        char* stack = (char*)uthread_malloc(STACK_SIZE);
+        if (stack == nullptr)
+        {
+                throw std::bad_alloc();
+        }
+        return stack;
+}
+
+static void freeStack(char* stack)
+{
+        if (_cached_stacks < STACK_CACHE_SIZE)
+        {
+                _stack_cache[_cached_stacks++] = stack;
+                return;
+        }
+        uthread_free(stack);
+}
+
+TCB::TCB(int tid, void *(*start_routine)(void* arg), void *arg, State state, size_t stack_arg_size): _tid(tid), _state(state), _priority(DEFAULT_PRIORITY), _quantum(0), _lock_count(0), _group(NO_GROUP), _base_priority(DEFAULT_PRIORITY), _inherited_priority(MIN_PRIORITY), _ceiling_priority(MIN_PRIORITY), _blocked_on(nullptr), _held_locks(nullptr)
 {
+        static_assert(offsetof(TCB, _stack_arg) + sizeof(void*) <= CACHE_LINE_SIZE,
+                      "scheduler fields must fit in one cache line");
+
+        _link.next = _link.prev = nullptr;
         _stack = nullptr;
+        _stack_arg = nullptr;
+        _tls_overflow = nullptr;
+        for (int i = 0; i < TLS_FAST_SLOTS; i++)
+        {
+                _tls[i] = nullptr;
+        }
+        for (int i = 0; i < ALLOC_CLASSES; i++)
+        {
+                _alloc_cache.free[i] = nullptr;
+                _alloc_cache.count[i] = 0;
+        }
 
         // Only allocate a stack and setup the context if this is not the main
         // thread
-        if (start_routine != NULL)
+        if (start_routine == NULL)
         {
-                // Allocate a stack for the new thread
-	        _stack = new char[STACK_SIZE];
+                // The main thread runs on the process stack, so its context
+                // gets a block of its own
+                initMainContext(&_context);
+                return;
+        }
+
+        // Allocate a stack for the new thread
+        _stack = allocateStack();
 
-                // Set up the context with the newly allocated stack
-                getcontext(&_context);
-                _context.uc_stack.ss_sp = _stack;
-                _context.uc_stack.ss_size = STACK_SIZE;
-                _context.uc_stack.ss_flags = 0;
+        // Carve the reserved buffer out of the top of the stack, keeping the
+        // stack below it 16-byte aligned
+        size_t stack_size = stackTop() - _stack;
+        if (stack_arg_size > 0)
+        {
+                stack_size = (stack_size - stack_arg_size) & ~(size_t)15;
+                _stack_arg = _stack + stack_size;
+                arg = _stack_arg;
+        }
 
-                // Set the context to call the stub
-                makecontext(&_context, (void(*)())stub, 2, start_routine, arg);
+        // Paint the stack before the context is set up on top of it, cached
+        // stacks still carry the last thread's marks
+        if (_paint_stacks)
+        {
+                unsigned long* word = (unsigned long*)_stack;
+                unsigned long* end = (unsigned long*)(_stack + stack_size);
+                while (word < end)
+                {
+                        *word++ = STACK_CANARY;
+                }
         }
+
+        // Set the context to call the stub on the new stack
+        initContext(&_context, _stack, stack_size, stub, start_routine, arg);
 }
 
 TCB::~TCB()
 {
         if (_stack)
         {
-	        delete[] _stack;
+	        freeStack(_stack);
+        }
+        else
+        {
+                freeMainContext(&_context);
         }
+        delete _tls_overflow;
+        releaseAllocCache(&_alloc_cache);
 }
 
 void TCB::setState(State state)
@@ -78,36 +190,38 @@ int TCB::getLockCount()
 
 void TCB::increasePriority()
 {
-    assert( _priority != MAX_PRIORITY );
-    switch ( _priority )
+    assert( _base_priority != MAX_PRIORITY );
+    switch ( _base_priority )
     {
     case GREEN:
-        _priority = ORANGE;
+        _base_priority = ORANGE;
         break;
     case ORANGE:
-        _priority = RED;
+        _base_priority = RED;
         break;
     default:
         // Should never be reached
         break;
     }
+    updatePriority( );
 }
 
 void TCB::decreasePriority()
 {
-    assert( _priority != MIN_PRIORITY );
-    switch ( _priority )
+    assert( _base_priority != MIN_PRIORITY );
+    switch ( _base_priority )
     {
     case RED:
-        _priority = ORANGE;
+        _base_priority = ORANGE;
         break;
     case ORANGE:
-        _priority = GREEN;
+        _base_priority = GREEN;
         break;
     default:
         // Should never be reached
         break;
     }
+    updatePriority( );
 }
 
 Priority TCB::getPriority()
@@ -115,7 +229,130 @@ Priority TCB::getPriority()
     return _priority;
 }
 
-ucontext_t* TCB::getContext()
+Priority TCB::getBasePriority() const
+{
+    return _base_priority;
+}
+
+void TCB::setInheritedPriority(Priority priority)
+{
+    _inherited_priority = priority;
+    updatePriority( );
+}
+
+Priority TCB::getCeilingPriority() const
+{
+    return _ceiling_priority;
+}
+
+void TCB::setCeilingPriority(Priority priority)
+{
+    _ceiling_priority = priority;
+    updatePriority( );
+}
+
+void TCB::updatePriority()
+{
+    _priority = std::max( _base_priority, std::max( _inherited_priority, _ceiling_priority ) );
+}
+
+Lock* TCB::getBlockedOn() const
+{
+	return _blocked_on;
+}
+
+void TCB::setBlockedOn(Lock* lock)
+{
+	_blocked_on = lock;
+}
+
+Lock* TCB::getHeldLocks() const
+{
+	return _held_locks;
+}
+
+void TCB::setHeldLocks(Lock* lock)
+{
+	_held_locks = lock;
+}
+
+void TCB::setGroup(int group)
+{
+	_group = group;
+}
+
+int TCB::getGroup() const
+{
+	return _group;
+}
+
+void TCB::setStackPainting(bool enable)
+{
+	_paint_stacks = enable;
+}
+
+size_t TCB::getStackUsage() const
+{
+	if (!_paint_stacks || _stack == nullptr)
+	{
+		return 0;
+	}
+
+	// Stacks grow down, so the first word from the bottom that lost its
+	// paint marks the deepest point reached
+	const unsigned long* word = (const unsigned long*)_stack;
+	const unsigned long* end = (const unsigned long*)stackTop();
+	while (word < end && *word == STACK_CANARY)
+	{
+		word++;
+	}
+	return (const char*)end - (const char*)word;
+}
+
+void* TCB::getStackArg()
+{
+	return _stack_arg;
+}
+
+void TCB::setSpecific(int key, void* value)
+{
+	if (key < TLS_FAST_SLOTS)
+	{
+		_tls[key] = value;
+		return;
+	}
+
+	// Keys past the inline slots live in a table that grows on demand
+	if (_tls_overflow == nullptr)
+	{
+		if (value == nullptr)
+		{
+			return;
+		}
+		_tls_overflow = new std::vector<void*, UthreadAllocator<void*> >();
+	}
+	if (key - TLS_FAST_SLOTS >= (int)_tls_overflow->size())
+	{
+		if (value == nullptr)
+		{
+			return;
+		}
+		_tls_overflow->resize(key - TLS_FAST_SLOTS + 1, nullptr);
+	}
+	(*_tls_overflow)[key - TLS_FAST_SLOTS] = value;
+}
+
+Context* TCB::getContext()
 {
 	return &_context;
+}
+
+AllocCache* TCB::getAllocCache()
+{
+	return &_alloc_cache;
+}
+
+char* TCB::stackTop() const
+{
+	return (_stack_arg != nullptr) ? (char*)_stack_arg : _stack + STACK_SIZE;
 }
\ No newline at end of file
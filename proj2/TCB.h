@@ -5,25 +5,48 @@
 #define TCB_H
 
 #include "uthread.h"
+#include "Context.h"
+#include "Allocator.h"
 #include <stdio.h>
 #include <signal.h>
 #include <ucontext.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <iostream>
+#include <vector>
 
 extern void stub(void *(*start_routine)(void *), void *arg);
 
-enum State {READY, RUNNING, BLOCK};
+class Lock;
+
+// THROTTLED threads are ready but held back on their budget group's throttled
+// queue until the next period, they must not be run or moved to a ready queue
+enum State {READY, RUNNING, BLOCK, THROTTLED};
 
 #define MAX_PRIORITY     RED
 #define DEFAULT_PRIORITY ORANGE
 #define MIN_PRIORITY     GREEN
 
+#define TLS_FAST_SLOTS   8  /* thread-local storage keys stored inline in the TCB */
+#define CACHE_LINE_SIZE  64
+#define TCB_SLAB_COUNT   32 /* TCBs carved out of each slab allocation */
+#define STACK_CACHE_SIZE 32 /* stacks of deleted threads kept for reuse */
+#define STACK_CANARY     0x57ac57ac57ac57acUL /* pattern painted on unused stack */
+
+// Links for the intrusive queue (see TCBQueue.h) the thread is on, if any
+struct TCBLink
+{
+	TCBLink* next;
+	TCBLink* prev;
+};
+
 /*
  * The thread
+ * NOTE: The fields the scheduler touches on every switch share the first
+ *       cache line. The saved registers live at the top of the thread's
+ *       stack, not in the TCB
  */
-class TCB
+class alignas(CACHE_LINE_SIZE) TCB
 {
 
 public:
@@ -34,14 +57,25 @@ public:
 	 * @param f the thread function that get no args and return nothing
          * @param arg the thread function argument
 	 * @param state current state for the new thread
+	 * @param stack_arg_size bytes to reserve at the top of the stack. When
+	 *        non-zero, the thread function is passed the reserved buffer
+	 *        instead of arg
 	 */
-	TCB(int tid, void *(*start_routine)(void* arg), void *arg, State state);
+	TCB(int tid, void *(*start_routine)(void* arg), void *arg, State state, size_t stack_arg_size = 0);
 	
 	/**
 	 * thread d-tor
 	 */
 	~TCB();
 
+	/**
+	 * TCBs are handed out from cache line aligned slabs
+	 * NOTE: Callers must have interrupts disabled. The same goes for the
+	 *       constructor and destructor, which reuse cached stacks
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr);
+
 	/**
 	 * function to set the thread state
 	 * @param state the new state for our thread
@@ -98,25 +132,164 @@ public:
 	void decreasePriority();
 
     /**
-	 * function that returns the priority of this thread
+	 * function that returns the priority the thread is scheduled at, the
+	 * highest of its own priority and the ones it gets through its locks
 	 */
     Priority getPriority();
 
+	/**
+	 * function that returns the priority set for this thread, ignoring
+	 * priority inheritance
+	 */
+	Priority getBasePriority() const;
+
+	/**
+	 * function that sets the priority the thread inherits from the threads
+	 * waiting on its locks
+	 * @param priority the inherited priority, MIN_PRIORITY if none
+	 */
+	void setInheritedPriority(Priority priority);
+
+	/**
+	 * function that returns the priority the thread runs at because of the
+	 * ceiling locks it holds
+	 * @return the ceiling priority, MIN_PRIORITY if none
+	 */
+	Priority getCeilingPriority() const;
+
+	/**
+	 * function that sets the priority the thread runs at because of the
+	 * ceiling locks it holds
+	 * @param priority the ceiling priority, MIN_PRIORITY if none
+	 */
+	void setCeilingPriority(Priority priority);
+
+	/**
+	 * function that returns the lock the thread is blocked on
+	 * @return the lock, nullptr if the thread is not waiting for a lock
+	 */
+	Lock* getBlockedOn() const;
+
+	/**
+	 * function that sets the lock the thread is blocked on
+	 * @param lock the lock, nullptr once the thread stops waiting
+	 */
+	void setBlockedOn(Lock* lock);
+
+	/**
+	 * function that returns the first of the locks the thread holds
+	 * @return the lock, nullptr if the thread holds no Lock
+	 */
+	Lock* getHeldLocks() const;
+
+	/**
+	 * function that sets the first of the locks the thread holds
+	 * @param lock the lock, the rest are linked from it
+	 */
+	void setHeldLocks(Lock* lock);
+
+	/**
+	 * function that sets the thread's budget group
+	 * @param group the group id, NO_GROUP to leave the thread's group
+	 */
+	void setGroup(int group);
+
+	/**
+	 * function that returns the thread's budget group
+	 * @return the group id, NO_GROUP if the thread is in no group
+	 */
+	int getGroup() const;
+
+	/**
+	 * function that turns painting the stacks of new threads with
+	 * STACK_CANARY on or off. getStackUsage needs painted stacks
+	 * @param enable true to paint stacks
+	 */
+	static void setStackPainting(bool enable);
+
+	/**
+	 * function that returns the most stack the thread has used so far
+	 * @return the high-water mark in bytes, 0 if the stack was not painted
+	 */
+	size_t getStackUsage() const;
+
+	/**
+	 * function that returns the buffer reserved at the top of the thread's stack
+	 * @return the reserved buffer, nullptr if no bytes were reserved
+	 */
+	void* getStackArg();
+
+	/**
+	 * function that gets the thread's value for a thread-local storage key
+	 * @param key the key, must not be negative
+	 * @return the stored value, nullptr if none has been set
+	 */
+	void* getSpecific(int key) const;
+
+	/**
+	 * function that sets the thread's value for a thread-local storage key
+	 * @param key the key, must not be negative
+	 * @param value the new value
+	 */
+	void setSpecific(int key, void* value);
+
     /**
 	 * function that returns a pointer to the thread's context storage location
-         * @return zero on success, -1 on failure
+         * @return the context storage location
+	 */
+	Context* getContext();
+
+	/**
+	 * function that returns the thread's cache of free memory blocks
+	 * @return the cache
 	 */
-	ucontext_t* getContext();
+	AllocCache* getAllocCache();
 
 private:
+	// Hot: scheduler state, first cache line
+	TCBLink _link;          // Position in the ready/wait queue holding the thread
 	int _tid;               // The thread id number.
-	int _quantum;           // The time interval, as explained in the pdf.
 	State _state;           // The state of the thread
+    Priority _priority;     // The priority the thread is scheduled at
+	int _quantum;           // The time interval, as explained in the pdf.
 	int _lock_count;        // The number of locks held by the thread
-    Priority _priority;     // The priority of the thread
+	int _group;             // The thread's budget group, NO_GROUP if none
+	Context _context;       // The thread's saved registers
 	char* _stack;           // The thread's stack
-	ucontext_t _context;    // The thread's saved context
+	void* _stack_arg;       // Buffer reserved at the top of the stack
+
+	// Thread-local storage, second cache line
+	alignas(CACHE_LINE_SIZE) void* _tls[TLS_FAST_SLOTS]; // Values for the first TLS keys
+	std::vector<void*, UthreadAllocator<void*> >* _tls_overflow; // Values for the remaining TLS keys
+	Priority _base_priority; // The priority set for the thread
+	Priority _inherited_priority; // Highest priority of a thread waiting on its locks
+	Priority _ceiling_priority; // Highest ceiling of the CeilingLocks it holds
+	Lock* _blocked_on;      // Lock the thread is waiting for, if any
+	Lock* _held_locks;      // Locks the thread holds, linked through the locks
+	AllocCache _alloc_cache; // Free memory blocks kept by the thread
+
+	// Return the end of the stack below the reserved buffer
+	char* stackTop() const;
+
+	// Recompute _priority from the priorities it is the highest of
+	void updatePriority();
+
+	friend class TCBQueue;
 };
 
+// The common case is a single indexed load, so keep it inline
+inline void* TCB::getSpecific(int key) const
+{
+	if (key < TLS_FAST_SLOTS)
+	{
+		return _tls[key];
+	}
+	if (_tls_overflow == nullptr || key - TLS_FAST_SLOTS >= (int)_tls_overflow->size())
+	{
+		return nullptr;
+	}
+	return (*_tls_overflow)[key - TLS_FAST_SLOTS];
+}
+
 
 #endif /* TCB_H */
@@ -0,0 +1,87 @@
+#ifndef TCB_QUEUE_H
+#define TCB_QUEUE_H
+
+#include "TCB.h"
+#include <cassert>
+#include <cstddef>
+
+// Intrusive FIFO of threads, linked through the TCB itself. A thread can be on
+// at most one TCBQueue at a time (ready queue, wait queue, ...), which makes
+// removing a thread from whichever queue it is on O(1) without a search
+// NOTE: Callers must have interrupts disabled
+class TCBQueue {
+public:
+  TCBQueue() { head.next = head.prev = &head; }
+  TCBQueue(const TCBQueue &) = delete;
+  TCBQueue& operator=(const TCBQueue &) = delete;
+
+  bool empty() const { return head.next == &head; }
+
+  // Return the thread at the front of the queue, nullptr if empty
+  TCB* front() const { return empty() ? nullptr : toTCB(head.next); }
+
+  // Return the thread after tcb in the queue, nullptr if tcb is the last one
+  TCB* next(TCB *tcb) const
+  {
+    TCBLink *link = tcb->_link.next;
+    return link == &head ? nullptr : toTCB(link);
+  }
+
+  // Add a thread to the back of the queue
+  void push(TCB *tcb) { insertBefore(&head, tcb); }
+
+  // Add a thread to the front of the queue
+  void push_front(TCB *tcb) { insertBefore(head.next, tcb); }
+
+  // Remove the thread at the front of the queue
+  void pop() { assert(!empty()); remove(toTCB(head.next)); }
+
+  // Move every thread in other to the back of this queue in one step
+  void splice(TCBQueue &other)
+  {
+    if (other.empty())
+    {
+      return;
+    }
+    TCBLink *first = other.head.next;
+    TCBLink *last = other.head.prev;
+    first->prev = head.prev;
+    head.prev->next = first;
+    last->next = &head;
+    head.prev = last;
+    other.head.next = other.head.prev = &other.head;
+  }
+
+  // Unlink a thread from whatever queue it is on
+  static void remove(TCB *tcb)
+  {
+    TCBLink *link = &tcb->_link;
+    assert(link->next != nullptr);
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = link->prev = nullptr;
+  }
+
+  // Return true if the thread is on a queue
+  static bool isQueued(const TCB *tcb) { return tcb->_link.next != nullptr; }
+
+private:
+  TCBLink head;   // Sentinel, head.next is the front and head.prev the back
+
+  static TCB* toTCB(TCBLink *link)
+  {
+    return reinterpret_cast<TCB *>(reinterpret_cast<char *>(link) - offsetof(TCB, _link));
+  }
+
+  static void insertBefore(TCBLink *pos, TCB *tcb)
+  {
+    TCBLink *link = &tcb->_link;
+    assert(link->next == nullptr);
+    link->next = pos;
+    link->prev = pos->prev;
+    pos->prev->next = link;
+    pos->prev = link;
+  }
+};
+
+#endif // TCB_QUEUE_H
@@ -0,0 +1,164 @@
+#include "ThreadPool.h"
+#include "uthread_private.h"
+
+ThreadPool::ThreadPool(int num_workers)
+{
+    for (int i = 0; i < num_workers; i++)
+    {
+        int tid = uthread_create(worker, this);
+        if (tid < 0)
+        {
+            break;
+        }
+        worker_tids.push_back(tid);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    disableInterrupts();
+
+    // Wake every idle worker so it can see the pool is shutting down
+    shutting_down = true;
+    for (TCB *tcb : idle_workers)
+    {
+        tcb->setState(READY);
+        addToReady(tcb);
+    }
+    idle_workers.clear();
+
+    enableInterrupts();
+
+    for (int tid : worker_tids)
+    {
+        uthread_join(tid, nullptr);
+    }
+}
+
+int ThreadPool::submit(void* (*start_routine)(void*), void* arg)
+{
+    if (start_routine == nullptr || worker_tids.empty())
+    {
+        return -1;
+    }
+
+    disableInterrupts();
+
+    // Reuse a released task slot if there is one
+    int handle;
+    if (!free_handles.empty())
+    {
+        handle = free_handles.back();
+        free_handles.pop_back();
+    }
+    else
+    {
+        handle = tasks.size();
+        tasks.push_back(task_t());
+    }
+
+    task_t &task = tasks[handle];
+    task.start_routine = start_routine;
+    task.arg = arg;
+    task.result = nullptr;
+    task.in_use = true;
+    task.done = false;
+    task.waiter = nullptr;
+    task_queue.push(handle);
+
+    // Hand the task to an idle worker if one is blocked on the empty queue
+    if (!idle_workers.empty())
+    {
+        TCB *tcb = idle_workers.back();
+        idle_workers.pop_back();
+        tcb->setState(READY);
+        addToReady(tcb);
+    }
+
+    enableInterrupts();
+    return handle;
+}
+
+int ThreadPool::wait(int handle, void **retval)
+{
+    disableInterrupts();
+
+    if (handle < 0 || handle >= (int)tasks.size() || !tasks[handle].in_use ||
+        tasks[handle].waiter != nullptr)
+    {
+        enableInterrupts();
+        return -1;
+    }
+
+    if (!tasks[handle].done)
+    {
+        // Block until the worker running the task wakes this thread up
+        tasks[handle].waiter = running;
+        running->setState(BLOCK);
+        switchThreads();
+    }
+
+    if (retval)
+    {
+        *retval = tasks[handle].result;
+    }
+
+    // Release the handle
+    tasks[handle].in_use = false;
+    free_handles.push_back(handle);
+
+    enableInterrupts();
+    return 0;
+}
+
+int ThreadPool::size() const
+{
+    return worker_tids.size();
+}
+
+void* ThreadPool::worker(void *arg)
+{
+    ThreadPool *pool = (ThreadPool *)arg;
+
+    disableInterrupts();
+    while (true)
+    {
+        if (pool->task_queue.empty())
+        {
+            if (pool->shutting_down)
+            {
+                break;
+            }
+
+            // Block until submit() or the destructor wakes this worker
+            running->setState(BLOCK);
+            pool->idle_workers.push_back(running);
+            switchThreads();
+            continue;
+        }
+
+        int handle = pool->task_queue.front();
+        pool->task_queue.pop();
+        void* (*start_routine)(void*) = pool->tasks[handle].start_routine;
+        void *task_arg = pool->tasks[handle].arg;
+
+        // Run the task with interrupts enabled like any other thread body
+        enableInterrupts();
+        void *result = start_routine(task_arg);
+        disableInterrupts();
+
+        // NOTE: Index again since tasks may have grown while the task ran
+        task_t &task = pool->tasks[handle];
+        task.result = result;
+        task.done = true;
+        if (task.waiter)
+        {
+            task.waiter->setState(READY);
+            addToReady(task.waiter);
+            task.waiter = nullptr;
+        }
+    }
+    enableInterrupts();
+
+    return nullptr;
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "TCB.h"
+#include "Allocator.h"
+#include <deque>
+#include <queue>
+#include <vector>
+
+// Pool of long-lived worker threads that run submitted tasks. A task runs on
+// an existing worker at the cost of a function call instead of paying for a
+// new TCB, stack and makecontext like uthread_create does
+class ThreadPool {
+public:
+  // Spawn num_workers worker threads
+  // NOTE: uthread_init must have been called first
+  ThreadPool(int num_workers);
+
+  // Let the workers drain the task queue, then join them
+  ~ThreadPool();
+
+  // Queue start_routine(arg) to run on one of the workers
+  // Return a handle for the task on success, -1 on failure
+  int submit(void* (*start_routine)(void*), void* arg);
+
+  // Block the calling thread until the task finishes and release its handle.
+  // The task's return value is stored in retval if retval is not null
+  // Return 0 on success, -1 on failure
+  int wait(int handle, void **retval);
+
+  // Return the number of worker threads in the pool
+  int size() const;
+
+private:
+  typedef struct task {
+    void* (*start_routine)(void*);
+    void *arg;
+    void *result;
+    bool in_use;         // Handle is allocated
+    bool done;           // Task has returned
+    TCB *waiter;         // Thread blocked in wait() on this task, if any
+  } task_t;
+
+  std::vector<task_t, UthreadAllocator<task_t> > tasks;  // Task slots, indexed by handle
+  std::vector<int, UthreadAllocator<int> > free_handles; // Task slots available for reuse
+  std::queue<int, std::deque<int, UthreadAllocator<int> > > task_queue; // Submitted tasks not yet started
+  std::vector<TCB *, UthreadAllocator<TCB *> > idle_workers; // Workers blocked on an empty queue
+  std::vector<int, UthreadAllocator<int> > worker_tids;
+  bool shutting_down = false;
+
+  // Worker thread loop: run queued tasks, block when the queue is empty
+  static void* worker(void *arg);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,126 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "SpinLock.h"
+#include "AdaptiveLock.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define THREAD_COUNT 8
+#define ITERATIONS 20000
+
+// Threads alternate between holding the lock and working outside it for the
+// same amount of time, so the lock is held about half the time
+enum LockKind { KIND_LOCK, KIND_ADAPTIVE, KIND_SPINLOCK };
+static LockKind lock_kind;
+static Lock lock;
+static AdaptiveLock adaptive_lock;
+static SpinLock spin_lock;
+
+static long hold_ns;
+static long counter = 0;
+
+// Burn CPU for nsecs without giving up the thread
+void spin_for(long nsecs) {
+  auto end = chrono::steady_clock::now() + chrono::nanoseconds(nsecs);
+  while (chrono::steady_clock::now() < end) {
+  }
+}
+
+void lock_counter() {
+  switch (lock_kind) {
+  case KIND_LOCK: lock.lock(); break;
+  case KIND_ADAPTIVE: adaptive_lock.lock(); break;
+  case KIND_SPINLOCK: spin_lock.lock(); break;
+  }
+}
+
+void unlock_counter() {
+  switch (lock_kind) {
+  case KIND_LOCK: lock.unlock(); break;
+  case KIND_ADAPTIVE: adaptive_lock.unlock(); break;
+  case KIND_SPINLOCK: spin_lock.unlock(); break;
+  }
+}
+
+void* worker(void *arg) {
+  for (int i = 0; i < ITERATIONS; i++) {
+    lock_counter();
+    spin_for(hold_ns);
+    counter++;
+    unlock_counter();
+
+    spin_for(hold_ns);
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./adaptive-performance <lock|adaptive|spinlock> <hold nsecs>" << endl;
+    cerr << "Example: ./adaptive-performance adaptive 5000" << endl;
+    exit(1);
+  }
+
+  if (strcmp(argv[1], "lock") == 0) {
+    lock_kind = KIND_LOCK;
+  }
+  else if (strcmp(argv[1], "adaptive") == 0) {
+    lock_kind = KIND_ADAPTIVE;
+  }
+  else if (strcmp(argv[1], "spinlock") == 0) {
+    lock_kind = KIND_SPINLOCK;
+  }
+  else {
+    cerr << "Error: lock must be lock, adaptive or spinlock" << endl;
+    exit(1);
+  }
+
+  hold_ns = atol(argv[2]);
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  auto start = chrono::steady_clock::now();
+
+  vector<int> threads;
+  for (int i = 0; i < THREAD_COUNT; i++) {
+    int tid = uthread_create(worker, nullptr);
+    if (tid < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+    threads.push_back(tid);
+  }
+
+  for (int tid : threads) {
+    uthread_join(tid, nullptr);
+  }
+
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (counter != (long)THREAD_COUNT * ITERATIONS) {
+    cerr << "Error: counter is " << counter << endl;
+    exit(1);
+  }
+
+  uthread_stats_t stats;
+  uthread_get_stats(&stats);
+
+  cout << argv[1] << ", " << hold_ns << " ns holds: " << secs << " s, "
+       << stats.switches << " switches";
+  if (lock_kind == KIND_ADAPTIVE) {
+    cout << ", average hold " << adaptive_lock.getAverageHoldNs() << " ns";
+  }
+  cout << endl;
+
+  return 0;
+}
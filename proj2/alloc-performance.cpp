@@ -0,0 +1,127 @@
+#include "uthread.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define LIVE_BLOCKS 64
+
+static long ops_per_thread;
+static bool use_uthread_malloc;
+static sigset_t timer_signal;
+
+// Plain malloc has to run with the timer masked, or a thread preempted while
+// holding malloc's lock deadlocks the next thread that allocates
+void* masked_malloc(size_t size) {
+  sigprocmask(SIG_BLOCK, &timer_signal, nullptr);
+  void *ptr = malloc(size);
+  sigprocmask(SIG_UNBLOCK, &timer_signal, nullptr);
+  return ptr;
+}
+
+void masked_free(void *ptr) {
+  sigprocmask(SIG_BLOCK, &timer_signal, nullptr);
+  free(ptr);
+  sigprocmask(SIG_UNBLOCK, &timer_signal, nullptr);
+}
+
+// Keep a window of live blocks and replace one per step with a block of a
+// random small size, like a thread building and tearing down small objects
+void* churn(void *arg) {
+  unsigned int seed = (unsigned int)(long)arg;
+  void *live[LIVE_BLOCKS] = { nullptr };
+
+  for (long i = 0; i < ops_per_thread; i++) {
+    int slot = i % LIVE_BLOCKS;
+    size_t size = 16 + rand_r(&seed) % 240;
+    if (use_uthread_malloc) {
+      uthread_free(live[slot]);
+      live[slot] = uthread_malloc(size);
+    }
+    else {
+      masked_free(live[slot]);
+      live[slot] = masked_malloc(size);
+    }
+    if (live[slot] == nullptr) {
+      cerr << "Error: out of memory" << endl;
+      exit(1);
+    }
+    memset(live[slot], 0, 16);
+  }
+
+  for (int slot = 0; slot < LIVE_BLOCKS; slot++) {
+    if (use_uthread_malloc) {
+      uthread_free(live[slot]);
+    }
+    else {
+      masked_free(live[slot]);
+    }
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    cerr << "Usage: ./alloc-performance <uthread|malloc> <threads> <ops per thread>" << endl;
+    cerr << "Example: ./alloc-performance uthread 8 1000000" << endl;
+    exit(1);
+  }
+
+  if (strcmp(argv[1], "uthread") == 0) {
+    use_uthread_malloc = true;
+  }
+  else if (strcmp(argv[1], "malloc") == 0) {
+    use_uthread_malloc = false;
+  }
+  else {
+    cerr << "Error: allocator must be uthread or malloc" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[2]);
+  ops_per_thread = atol(argv[3]);
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  sigemptyset(&timer_signal);
+  sigaddset(&timer_signal, SIGVTALRM);
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  int *threads = new int[thread_count];
+
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = uthread_create(churn, (void*)(long)(i + 1));
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  for (int i = 0; i < thread_count; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+  auto end = chrono::steady_clock::now();
+
+  delete[] threads;
+
+  double secs = chrono::duration<double>(end - start).count();
+  double ops = (double)thread_count * ops_per_thread;
+  cout << argv[1] << ": " << secs << " s (" << (secs * 1e9 / ops)
+       << " ns per malloc/free pair)" << endl;
+
+  return 0;
+}
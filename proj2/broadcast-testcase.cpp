@@ -0,0 +1,163 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "CondVar.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+
+// Waiters on two condition variables that share one lock. Each round the main
+// thread opens one gate and broadcasts it: every waiter at that gate has to
+// wake up exactly once, holding the lock by itself, in the order it started
+// waiting, and nobody at the other gate may wake up. The broadcasting thread
+// keeps running, and the round may only take about two switches per waiter
+// (to the waiter and away from it), which only holds if the waiters were
+// queued on the lock (wait morphing) instead of all being made ready to find
+// the lock held and block on it again
+static Lock gate_lock;
+static CondVar gate_cv[2];
+static int gate_round[2] = { 0, 0 };     // Times each gate was opened
+static int waiting[2] = { 0, 0 };        // Threads blocked at each gate
+static int wakeups[2] = { 0, 0 };        // Returns from wait() at each gate
+static bool in_critical_section = false;
+static vector<long> wake_order;
+
+static int rounds;
+
+void fail(const char *message) {
+  cerr << "Error: " << message << endl;
+  exit(1);
+}
+
+void* waiter(void *arg) {
+  long id = (long)arg;
+  int gate = id % 2;
+  for (int round = 1; round <= rounds; round++) {
+    gate_lock.lock();
+    waiting[gate]++;
+    while (gate_round[gate] < round) {
+      gate_cv[gate].wait(gate_lock);
+      wakeups[gate]++;
+    }
+    waiting[gate]--;
+
+    // Make sure the lock is only ever held by one woken thread
+    if (in_critical_section) {
+      fail("two threads hold the lock");
+    }
+    in_critical_section = true;
+    wake_order.push_back(id);
+    uthread_yield();
+    in_critical_section = false;
+
+    gate_lock.unlock();
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./broadcast-testcase <waiters per gate> <rounds>" << endl;
+    cerr << "Example: ./broadcast-testcase 20 100" << endl;
+    exit(1);
+  }
+
+  int per_gate = atoi(argv[1]);
+  rounds = atoi(argv[2]);
+
+  if (per_gate < 1 || per_gate > 49) {
+    cerr << "Error: <waiters per gate> must be between 1 and 49" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  vector<int> threads;
+  for (long i = 0; i < 2 * per_gate; i++) {
+    int tid = uthread_create(waiter, (void*)i);
+    if (tid < 0) {
+      fail("uthread_create");
+    }
+    threads.push_back(tid);
+  }
+
+  uthread_stats_t before, after;
+  unsigned long broadcast_switches = 0;
+  for (int round = 1; round <= rounds; round++) {
+    for (int gate = 0; gate < 2; gate++) {
+      // Wait for everybody to be blocked at the gate
+      while (true) {
+        gate_lock.lock();
+        bool ready = waiting[gate] == per_gate;
+        gate_lock.unlock();
+        if (ready) {
+          break;
+        }
+        uthread_yield();
+      }
+
+      gate_lock.lock();
+      int other_wakeups = wakeups[1 - gate];
+      wake_order.clear();
+      gate_round[gate] = round;
+      uthread_get_stats(&before);
+      gate_cv[gate].broadcast();
+      if (!wake_order.empty() || waiting[gate] != per_gate) {
+        fail("a waiter ran before the broadcasting thread released the lock");
+      }
+      gate_lock.unlock();
+
+      // Every waiter at the gate takes the lock once it is through
+      while (true) {
+        gate_lock.lock();
+        bool done = waiting[gate] == 0 && (int)wake_order.size() == per_gate;
+        gate_lock.unlock();
+        if (done) {
+          break;
+        }
+        uthread_yield();
+      }
+      uthread_get_stats(&after);
+      broadcast_switches += after.switches - before.switches;
+
+      if (wakeups[1 - gate] != other_wakeups) {
+        fail("a broadcast woke a thread waiting on the other condition variable");
+      }
+      for (int i = 0; i < per_gate; i++) {
+        if (wake_order[i] != 2 * i + gate) {
+          fail("waiters did not get the lock in the order they started waiting");
+        }
+      }
+    }
+  }
+
+  for (int tid : threads) {
+    uthread_join(tid, nullptr);
+  }
+
+  if (wakeups[0] != per_gate * rounds || wakeups[1] != per_gate * rounds) {
+    fail("a waiter woke up more than once per broadcast");
+  }
+
+  // Each waiter is switched to once with the lock and switched away from once
+  // (its yield), plus the main thread's polling. Waking the waiters without
+  // queueing them on the lock adds a switch per waiter that finds the lock
+  // held and blocks again
+  if (broadcast_switches > (unsigned long)(2 * rounds) * (2 * per_gate + 2)) {
+    fail("woken waiters blocked on the lock again, broadcast did not queue them on it");
+  }
+
+  cout << "Broadcast woke " << 2 * per_gate * rounds << " waiters, "
+       << (double)broadcast_switches / (2 * per_gate * rounds)
+       << " switches per waiter" << endl;
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "CeilingLock.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define SHARED_BUFFER_SIZE 10
+#define ITEM_USECS 500       // Work per item inside the critical section
+#define RED_NAP_USECS 3000   // RED's sleep between items
+
+// priority-testcase's shared buffer, without the condition variables. Threads
+// that find the buffer full/empty just drop the lock and try again later
+static int buffer[SHARED_BUFFER_SIZE];
+static int head = 0;
+static int tail = 0;
+static int item_count = 0;
+
+static bool use_ceiling;
+static Lock buffer_lock;
+static CeilingLock buffer_ceiling_lock(RED);
+static volatile bool done = false;
+
+void lock_buffer() {
+  if (use_ceiling) {
+    buffer_ceiling_lock.lock();
+  }
+  else {
+    buffer_lock.lock();
+  }
+}
+
+void unlock_buffer() {
+  if (use_ceiling) {
+    buffer_ceiling_lock.unlock();
+  }
+  else {
+    buffer_lock.unlock();
+  }
+}
+
+// Burn CPU for usecs without giving up the thread
+void spin_for(long usecs) {
+  auto end = chrono::steady_clock::now() + chrono::microseconds(usecs);
+  while (chrono::steady_clock::now() < end) {
+  }
+}
+
+// Produce or consume one item, whichever the buffer has room for
+void handle_item(bool produce) {
+  spin_for(ITEM_USECS);
+  if (produce && item_count < SHARED_BUFFER_SIZE) {
+    buffer[head] = uthread_self();
+    head = (head + 1) % SHARED_BUFFER_SIZE;
+    item_count++;
+  }
+  else if (!produce && item_count > 0) {
+    tail = (tail + 1) % SHARED_BUFFER_SIZE;
+    item_count--;
+  }
+}
+
+// GREEN and ORANGE threads: produce/consume as fast as they are scheduled.
+// A worker preempted in the critical section lets the others of its priority
+// run and queue up on the lock
+void* worker(void *arg) {
+  bool produce = (long)arg % 2 == 0;
+  while (!done) {
+    lock_buffer();
+    handle_item(produce);
+    unlock_buffer();
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    cerr << "Usage: ./ceiling-performance <lock|ceiling> <threads per priority> <red items>" << endl;
+    cerr << "Example: ./ceiling-performance ceiling 4 1000" << endl;
+    exit(1);
+  }
+
+  if (strcmp(argv[1], "lock") == 0) {
+    use_ceiling = false;
+  }
+  else if (strcmp(argv[1], "ceiling") == 0) {
+    use_ceiling = true;
+  }
+  else {
+    cerr << "Error: lock must be lock or ceiling" << endl;
+    exit(1);
+  }
+
+  int per_priority = atoi(argv[2]);
+  size_t red_items = atol(argv[3]);
+
+  if (per_priority < 1 || per_priority > 49) {
+    cerr << "Error: <threads per priority> must be between 1 and 49" << endl;
+    exit(1);
+  }
+
+  // Wake-ups are only noticed when the timer switches threads, so use the
+  // precise timer
+  uthread_set_timer_source(TIMER_MONOTONIC);
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // GREEN and ORANGE workers share the buffer with the RED main thread
+  Priority priorities[] = { GREEN, ORANGE };
+  vector<int> threads;
+  for (Priority priority : priorities) {
+    for (int i = 0; i < per_priority; i++) {
+      int tid = uthread_create(worker, (void*)(long)i);
+      if (tid < 0) {
+        cerr << "Error: uthread_create" << endl;
+        exit(1);
+      }
+      uthread_set_priority(tid, priority);
+      threads.push_back(tid);
+    }
+  }
+
+  // An item every few milliseconds, timing how long the lock takes
+  uthread_set_priority(uthread_self(), RED);
+  vector<double> red_waits;
+  for (size_t i = 0; i < red_items; i++) {
+    usleep(RED_NAP_USECS);
+
+    auto start = chrono::steady_clock::now();
+    lock_buffer();
+    auto end = chrono::steady_clock::now();
+    handle_item(i % 2 == 0);
+    unlock_buffer();
+
+    red_waits.push_back(chrono::duration<double, micro>(end - start).count());
+  }
+  done = true;
+
+  for (int tid : threads) {
+    uthread_join(tid, nullptr);
+  }
+
+  sort(red_waits.begin(), red_waits.end());
+  size_t n = red_waits.size();
+  double total = 0;
+  for (double wait : red_waits) {
+    total += wait;
+  }
+  cout << argv[1] << ": RED lock wait over " << n << " items (usecs): mean "
+       << total / n << ", p99 " << red_waits[n * 99 / 100] << ", max "
+       << red_waits.back() << endl;
+
+  return 0;
+}
@@ -4,6 +4,8 @@
 #include "CondVar.h"
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
 #include <iostream>
 
 using namespace std;
@@ -19,10 +21,19 @@ static int head = 0;
 static int tail = 0;
 static int item_count = 0;
 
-// Shared buffer synchronization
+// Shared buffer synchronization, with the condition variables of the
+// semantics picked on the command line
 static Lock buffer_lock;
-static CondVar need_space_cv;
-static CondVar need_item_cv;
+static CondVar hoare_need_space_cv(HOARE_SEMANTICS);
+static CondVar hoare_need_item_cv(HOARE_SEMANTICS);
+static CondVar mesa_need_space_cv(MESA_SEMANTICS);
+static CondVar mesa_need_item_cv(MESA_SEMANTICS);
+static CondVar *need_space_cv = &hoare_need_space_cv;
+static CondVar *need_item_cv = &hoare_need_item_cv;
+
+// Stop after this many items and report, 0 to run until killed
+static int item_limit = 0;
+static chrono::steady_clock::time_point start_time;
 
 // Bookkeeping
 static int produced_count = 0;
@@ -61,9 +72,9 @@ void* producer(void *arg) {
     buffer_lock.lock();
 
     // Wait for room in the buffer if needed
-    // NOTE: NOT Assuming Hoare semantics (TODO)
+    // NOTE: NOT Assuming Hoare semantics, so this works with Mesa too
     while (item_count == SHARED_BUFFER_SIZE) {
-      need_space_cv.wait(buffer_lock);
+      need_space_cv->wait(buffer_lock);
     }
 
     // Make sure synchronization is working correctly
@@ -78,7 +89,7 @@ void* producer(void *arg) {
     produced_count++;
 
     // Signal that there is now an item in the buffer
-    need_item_cv.signal();
+    need_item_cv->signal();
 
     producer_in_critical_section = false;
 
@@ -99,9 +110,9 @@ void* consumer(void *arg) {
     buffer_lock.lock();
 
     // Wait for an item in the buffer if needed
-    // NOTE: NOT Assuming Hoare semantics (TODO)
+    // NOTE: NOT Assuming Hoare semantics, so this works with Mesa too
     while (item_count == 0) {
-      need_item_cv.wait(buffer_lock);
+      need_item_cv->wait(buffer_lock);
     }
 
     // Make sure synchronization is working correctly
@@ -116,12 +127,24 @@ void* consumer(void *arg) {
     consumed_count++;
 
     // Print an update periodically
-    if ((consumed_count % PRINT_FREQUENCY) == 0) {
+    if (item_limit == 0 && (consumed_count % PRINT_FREQUENCY) == 0) {
       cout << "Consumed " << consumed_count << " items" << endl;
     }
 
+    // Report how the condition variables did
+    if (consumed_count == item_limit) {
+      double secs = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+      uthread_stats_t stats;
+      uthread_get_stats(&stats);
+      cout << (need_item_cv == &mesa_need_item_cv ? "mesa" : "hoare") << ": "
+           << consumed_count << " items in " << secs << " s, "
+           << consumed_count / secs << " items/sec, "
+           << (double)stats.switches / consumed_count << " switches/item" << endl;
+      exit(0);
+    }
+
     // Signal that there is now room in the buffer
-    need_space_cv.signal();
+    need_space_cv->signal();
 
     consumer_in_critical_section = false;
 
@@ -137,12 +160,28 @@ void* consumer(void *arg) {
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    cerr << "Usage: ./uthread-sync-demo <num_producer> <num_consumer>" << endl;
-    cerr << "Example: ./uthread-sync-demo 20 20" << endl;
+  if (argc != 3 && argc != 5) {
+    cerr << "Usage: ./condvar-testcase-buffer <num_producer> <num_consumer> [<hoare|mesa> <items>]" << endl;
+    cerr << "Example: ./condvar-testcase-buffer 20 20 mesa 1000000" << endl;
     exit(1);
   }
 
+  if (argc == 5) {
+    if (strcmp(argv[3], "mesa") == 0) {
+      need_space_cv = &mesa_need_space_cv;
+      need_item_cv = &mesa_need_item_cv;
+    }
+    else if (strcmp(argv[3], "hoare") != 0) {
+      cerr << "Error: semantics must be hoare or mesa" << endl;
+      exit(1);
+    }
+    item_limit = atoi(argv[4]);
+    if (item_limit <= 0) {
+      cerr << "Error: <items> must be positive" << endl;
+      exit(1);
+    }
+  }
+
   int producer_count = atoi(argv[1]);
   int consumer_count = atoi(argv[2]);
 
@@ -158,6 +197,8 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
+  start_time = chrono::steady_clock::now();
+
   // Create producer threads
   int *producer_threads = new int[producer_count];
   for (int i = 0; i < producer_count; i++) {
@@ -0,0 +1,110 @@
+#include "uthread.h"
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+
+// Fan-in side does all the work, the threads just hand back their argument
+void* leaf(void *arg) {
+  return arg;
+}
+
+// One fan-out/fan-in round with a uthread_create call per thread
+long round_with_create(int fan_out, void **args, int *tids) {
+  for (int i = 0; i < fan_out; i++) {
+    tids[i] = uthread_create(leaf, args[i]);
+    if (tids[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  long sum = 0;
+  for (int i = 0; i < fan_out; i++) {
+    void *result;
+    uthread_join(tids[i], &result);
+    sum += (long)result;
+  }
+  return sum;
+}
+
+// One fan-out/fan-in round with a single uthread_create_many call
+long round_with_create_many(int fan_out, void **args, int *tids) {
+  if (uthread_create_many(fan_out, leaf, args, tids) != 0) {
+    cerr << "Error: uthread_create_many" << endl;
+    exit(1);
+  }
+
+  long sum = 0;
+  for (int i = 0; i < fan_out; i++) {
+    void *result;
+    uthread_join(tids[i], &result);
+    sum += (long)result;
+  }
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./create-performance <fan_out> <rounds>" << endl;
+    cerr << "Example: ./create-performance 99 10000" << endl;
+    exit(1);
+  }
+
+  int fan_out = atoi(argv[1]);
+  int rounds = atoi(argv[2]);
+
+  if (fan_out < 1 || fan_out > 99) {
+    cerr << "Error: <fan_out> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  void **args = new void*[fan_out];
+  int *tids = new int[fan_out];
+  long expected = 0;
+  for (int i = 0; i < fan_out; i++) {
+    args[i] = (void*)(long)i;
+    expected += i;
+  }
+
+  auto start = chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    if (round_with_create(fan_out, args, tids) != expected) {
+      cerr << "Error: uthread_create results are wrong" << endl;
+      exit(1);
+    }
+  }
+  auto end = chrono::steady_clock::now();
+  double create_secs = chrono::duration<double>(end - start).count();
+
+  start = chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    if (round_with_create_many(fan_out, args, tids) != expected) {
+      cerr << "Error: uthread_create_many results are wrong" << endl;
+      exit(1);
+    }
+  }
+  end = chrono::steady_clock::now();
+  double create_many_secs = chrono::duration<double>(end - start).count();
+
+  delete[] args;
+  delete[] tids;
+
+  double threads = (double)fan_out * rounds;
+  cout << "uthread_create:      " << create_secs << " s ("
+       << (create_secs * 1e9 / threads) << " ns/thread)" << endl;
+  cout << "uthread_create_many: " << create_many_secs << " s ("
+       << (create_many_secs * 1e9 / threads) << " ns/thread)" << endl;
+
+  return 0;
+}
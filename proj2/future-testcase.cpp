@@ -0,0 +1,83 @@
+#include "uthread.h"
+#include "Future.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define MAX_WORKERS 98
+
+// Count random points that land inside the unit circle
+unsigned long count_points(int points, unsigned int seed) {
+  unsigned long local_cnt = 0;
+  for (int i = 0; i < points; i++) {
+    double x = rand_r(&seed) / ((double)RAND_MAX + 1) * 2.0 - 1.0;
+    double y = rand_r(&seed) / ((double)RAND_MAX + 1) * 2.0 - 1.0;
+    if (x * x + y * y < 1)
+      local_cnt++;
+  }
+  return local_cnt;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./future-testcase <total points> <threads>" << endl;
+    cerr << "Example: ./future-testcase 10000000 8" << endl;
+    exit(1);
+  }
+
+  unsigned long total_points = atol(argv[1]);
+  int thread_count = atoi(argv[2]);
+
+  if (thread_count < 1 || thread_count > MAX_WORKERS) {
+    cerr << "Error: <threads> must be between 1 and " << MAX_WORKERS << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  int points_per_thread = total_points / thread_count;
+  uthread::future<unsigned long> *results = new uthread::future<unsigned long>[thread_count];
+
+  // Results are returned by value, no heap-allocated return buffers
+  for (int i = 0; i < thread_count; i++) {
+    unsigned int seed = rand();
+    results[i] = uthread::async<unsigned long>([points_per_thread, seed]() {
+      return count_points(points_per_thread, seed);
+    });
+  }
+
+  // Collect the first half of the results in completion order
+  unsigned long g_cnt = 0;
+  for (int i = 0; i < thread_count / 2; i++) {
+    int index = uthread::when_any(results, thread_count);
+    assert(index >= 0);
+    unsigned long local_cnt = results[index].get();
+    cout << "Worker #" << index << " finished with " << local_cnt << endl;
+    g_cnt += local_cnt;
+  }
+
+  // Wait for the rest together
+  uthread::when_all(results, thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    if (results[i].valid()) {
+      assert(results[i].is_ready());
+      unsigned long local_cnt = results[i].get();
+      cout << "Worker #" << i << " finished with " << local_cnt << endl;
+      g_cnt += local_cnt;
+    }
+  }
+
+  delete[] results;
+
+  cout << "Pi: " << (4. * (double)g_cnt) / ((double)points_per_thread * thread_count) << endl;
+
+  return 0;
+}
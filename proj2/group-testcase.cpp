@@ -0,0 +1,162 @@
+#include "uthread.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define THREADS_PER_TENANT 2
+#define TENANT_COUNT 3
+#define REQUEST_GROUPS 100000
+#define CAPPED_PERCENT 5
+#define CAPPED_MSECS 500
+
+// Share of each GROUP_PERIOD_USECS period the tenants may use, 0 for no cap
+static const int tenant_percent[TENANT_COUNT] = {10, 30, 0};
+
+static volatile bool stop = false;
+static unsigned long work[TENANT_COUNT * THREADS_PER_TENANT];
+static volatile bool stop_capped = false;
+static unsigned long capped_run_ns = 0;
+
+static unsigned long nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// Add up the time the thread runs, counting gaps longer than a few
+// microseconds between clock reads as time some other thread ran
+void* capped(void *arg) {
+  unsigned long prev = nowNs();
+  while (!stop_capped) {
+    unsigned long now = nowNs();
+    if (now - prev < 20000) {
+      capped_run_ns += now - prev;
+    }
+    prev = now;
+  }
+  return nullptr;
+}
+
+void* spin(void *arg) {
+  long index = (long)arg;
+  while (!stop) {
+    work[index]++;
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: ./group-testcase <seconds>" << endl;
+    cerr << "Example: ./group-testcase 3" << endl;
+    exit(1);
+  }
+
+  int seconds = atoi(argv[1]);
+  if (seconds < 1) {
+    cerr << "Error: <seconds> must be positive" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // Per-request groups: creating, joining and deleting a group should be cheap
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < REQUEST_GROUPS; i++) {
+    int gid = uthread_group_create(GROUP_PERIOD_USECS / 2);
+    assert(gid >= 0);
+    ret = uthread_set_group(uthread_self(), gid);
+    assert(ret == 0);
+    ret = uthread_group_delete(gid);
+    assert(ret == 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed_ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+  cout << "Group create/join/delete: " << elapsed_ns / REQUEST_GROUPS << " ns" << endl;
+
+  // A throttled thread must not run because another thread yields to it or
+  // changes its priority
+  int gid = uthread_group_create(GROUP_PERIOD_USECS * CAPPED_PERCENT / 100);
+  assert(gid >= 0);
+  int capped_tid = uthread_create(capped, nullptr);
+  assert(capped_tid >= 0);
+  ret = uthread_set_group(capped_tid, gid);
+  assert(ret == 0);
+  unsigned long deadline = nowNs() + CAPPED_MSECS * 1000000UL;
+  for (int i = 0; nowNs() < deadline; i++) {
+    uthread_yield_to(capped_tid);
+    uthread_set_priority(capped_tid, (i % 2) ? RED : ORANGE);
+  }
+  stop_capped = true;
+  uthread_join(capped_tid, nullptr);
+  uthread_group_delete(gid);
+  cout << "Capped thread at " << CAPPED_PERCENT << "% budget ran "
+       << 100.0 * capped_run_ns / (CAPPED_MSECS * 1000000UL) << "% of the time" << endl;
+  if (capped_run_ns > 2 * CAPPED_MSECS * 1000000UL * CAPPED_PERCENT / 100) {
+    cerr << "Error: a throttled thread ran past its group's budget" << endl;
+    exit(1);
+  }
+
+  // Each tenant gets a group capped at its share and threads that never stop
+  int threads[TENANT_COUNT * THREADS_PER_TENANT];
+  for (int t = 0; t < TENANT_COUNT; t++) {
+    int gid = NO_GROUP;
+    if (tenant_percent[t] > 0) {
+      gid = uthread_group_create(GROUP_PERIOD_USECS * tenant_percent[t] / 100);
+      assert(gid >= 0);
+    }
+
+    for (int i = 0; i < THREADS_PER_TENANT; i++) {
+      int index = t * THREADS_PER_TENANT + i;
+      threads[index] = uthread_create(spin, (void *)(long)index);
+      assert(threads[index] >= 0);
+      if (gid != NO_GROUP) {
+        ret = uthread_set_group(threads[index], gid);
+        assert(ret == 0);
+      }
+    }
+  }
+
+  // Stay off the CPU while the tenants compete for it
+  uthread_sleep(seconds);
+  stop = true;
+
+  for (int i = 0; i < TENANT_COUNT * THREADS_PER_TENANT; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+
+  unsigned long total = 0;
+  for (int i = 0; i < TENANT_COUNT * THREADS_PER_TENANT; i++) {
+    total += work[i];
+  }
+  for (int t = 0; t < TENANT_COUNT; t++) {
+    unsigned long tenant_work = 0;
+    for (int i = 0; i < THREADS_PER_TENANT; i++) {
+      tenant_work += work[t * THREADS_PER_TENANT + i];
+    }
+    cout << "Tenant #" << t << " (";
+    if (tenant_percent[t] > 0) {
+      cout << tenant_percent[t] << "% budget";
+    }
+    else {
+      cout << "uncapped";
+    }
+    cout << "): " << 100.0 * tenant_work / total << "% of the work" << endl;
+  }
+
+  uthread_stats_t stats;
+  uthread_get_stats(&stats);
+  cout << "Throttles: " << stats.throttles << endl;
+
+  return 0;
+}
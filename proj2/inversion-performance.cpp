@@ -0,0 +1,123 @@
+#include "uthread.h"
+#include "Lock.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define HOLD_USECS 3000      // GREEN's critical section
+#define SPIN_USECS 30000     // ORANGE's busy bursts
+#define SPINNER_NAP_USECS 10000 // ORANGE's sleep between bursts
+#define RED_NAP_USECS 3000   // RED's sleep between lock attempts
+
+static Lock shared_lock;
+static volatile bool done = false;
+
+// Burn CPU for usecs without giving up the thread
+void spin_for(long usecs) {
+  auto end = chrono::steady_clock::now() + chrono::microseconds(usecs);
+  while (chrono::steady_clock::now() < end) {
+  }
+}
+
+// GREEN: keeps taking the lock for a short critical section
+void* holder(void *arg) {
+  while (!done) {
+    shared_lock.lock();
+    spin_for(HOLD_USECS);
+    shared_lock.unlock();
+    uthread_yield();
+  }
+  return nullptr;
+}
+
+// ORANGE: CPU-bound bursts that starve GREEN under strict priorities
+void* spinner(void *arg) {
+  while (!done) {
+    usleep(SPINNER_NAP_USECS);
+    spin_for(SPIN_USECS);
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./inversion-performance <spinners> <rounds>" << endl;
+    cerr << "Example: ./inversion-performance 4 200" << endl;
+    exit(1);
+  }
+
+  int spinner_count = atoi(argv[1]);
+  int rounds = atoi(argv[2]);
+
+  if (spinner_count < 1 || spinner_count > 97) {
+    cerr << "Error: <spinners> must be between 1 and 97" << endl;
+    exit(1);
+  }
+
+  // Wake-ups are only noticed when the timer switches threads, so use the
+  // precise timer
+  uthread_set_timer_source(TIMER_MONOTONIC);
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // The main thread is the RED thread measuring how long the lock takes
+  uthread_set_priority(uthread_self(), RED);
+
+  int holder_tid = uthread_create(holder, nullptr);
+  if (holder_tid < 0) {
+    cerr << "Error: uthread_create" << endl;
+    exit(1);
+  }
+  uthread_set_priority(holder_tid, GREEN);
+
+  int *spinners = new int[spinner_count];
+  for (int i = 0; i < spinner_count; i++) {
+    spinners[i] = uthread_create(spinner, nullptr);
+    if (spinners[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+    uthread_set_priority(spinners[i], ORANGE);
+  }
+
+  vector<double> waits;
+  for (int r = 0; r < rounds; r++) {
+    usleep(RED_NAP_USECS);
+
+    auto start = chrono::steady_clock::now();
+    shared_lock.lock();
+    auto end = chrono::steady_clock::now();
+    shared_lock.unlock();
+
+    waits.push_back(chrono::duration<double, micro>(end - start).count());
+  }
+
+  done = true;
+  uthread_join(holder_tid, nullptr);
+  for (int i = 0; i < spinner_count; i++) {
+    uthread_join(spinners[i], nullptr);
+  }
+  delete[] spinners;
+
+  sort(waits.begin(), waits.end());
+  double total = 0;
+  for (double wait : waits) {
+    total += wait;
+  }
+  cout << "RED lock wait over " << rounds << " rounds (usecs): mean "
+       << total / rounds << ", p50 " << waits[rounds / 2] << ", p99 "
+       << waits[rounds * 99 / 100] << ", max " << waits.back() << endl;
+
+  return 0;
+}
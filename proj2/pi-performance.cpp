@@ -0,0 +1,111 @@
+#include "uthread.h"
+#include "Parallel.h"
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+
+// Count random points of [begin, end) that land inside the unit circle. The
+// seed only depends on begin, so any split of the points gives the same total
+// as long as the chunks start at the same indices
+unsigned long count_points(long begin, long end) {
+  unsigned int seed = (unsigned int)begin * 2654435761u + 1;
+  unsigned long local_cnt = 0;
+  for (long i = begin; i < end; i++) {
+    double x = rand_r(&seed) / ((double)RAND_MAX + 1) * 2.0 - 1.0;
+    double y = rand_r(&seed) / ((double)RAND_MAX + 1) * 2.0 - 1.0;
+    if (x * x + y * y < 1)
+      local_cnt++;
+  }
+  return local_cnt;
+}
+
+// proj1's pi: one thread per slice, counts returned through heap buffers
+long points_per_thread;
+
+void* worker(void *arg) {
+  long begin = (long)arg * points_per_thread;
+  // NOTE: Parent thread must deallocate
+  unsigned long *return_buffer = new unsigned long;
+  *return_buffer = count_points(begin, begin + points_per_thread);
+  return return_buffer;
+}
+
+unsigned long pi_by_hand(long total_points, int thread_count) {
+  int *threads = new int[thread_count];
+  points_per_thread = total_points / thread_count;
+
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = uthread_create(worker, (void*)(long)i);
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  unsigned long g_cnt = 0;
+  for (int i = 0; i < thread_count; i++) {
+    unsigned long *local_cnt = nullptr;
+    uthread_join(threads[i], (void**)&local_cnt);
+    g_cnt += *local_cnt;
+    delete local_cnt;
+  }
+
+  delete[] threads;
+  return g_cnt;
+}
+
+unsigned long pi_by_reduce(long total_points, long grain) {
+  return uthread::parallel_reduce(uthread::range{0, total_points}, grain, 0ul,
+    [](uthread::range chunk, unsigned long cnt) {
+      return cnt + count_points(chunk.begin, chunk.end);
+    },
+    [](unsigned long a, unsigned long b) { return a + b; });
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    cerr << "Usage: ./pi-performance <total points> <threads> <grain>" << endl;
+    cerr << "Example: ./pi-performance 100000000 8 100000" << endl;
+    exit(1);
+  }
+
+  long total_points = atol(argv[1]);
+  int thread_count = atoi(argv[2]);
+  long grain = atol(argv[3]);
+
+  if (thread_count < 1 || thread_count > PARALLEL_WORKERS_MAX) {
+    cerr << "Error: <threads> must be between 1 and " << PARALLEL_WORKERS_MAX << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  total_points -= total_points % thread_count;
+
+  auto start = chrono::steady_clock::now();
+  unsigned long hand_cnt = pi_by_hand(total_points, thread_count);
+  auto end = chrono::steady_clock::now();
+  double hand_secs = chrono::duration<double>(end - start).count();
+
+  uthread::set_parallel_workers(thread_count);
+  start = chrono::steady_clock::now();
+  unsigned long reduce_cnt = pi_by_reduce(total_points, grain);
+  end = chrono::steady_clock::now();
+  double reduce_secs = chrono::duration<double>(end - start).count();
+
+  cout << "create/join:     " << hand_secs << " s, Pi: "
+       << (4. * (double)hand_cnt) / (double)total_points << endl;
+  cout << "parallel_reduce: " << reduce_secs << " s, Pi: "
+       << (4. * (double)reduce_cnt) / (double)total_points << endl;
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include "uthread.h"
+#include "ThreadPool.h"
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+#define BATCH_SIZE 64
+
+// Tiny unit of work so the benchmark measures per-task overhead
+void* tiny_task(void *arg) {
+  return (void*)((long)arg + 1);
+}
+
+// Run num_tasks tasks with one uthread_create/uthread_join per task
+long run_with_threads(long num_tasks) {
+  int tids[BATCH_SIZE];
+  long sum = 0;
+
+  for (long done = 0; done < num_tasks; done += BATCH_SIZE) {
+    int batch = (num_tasks - done < BATCH_SIZE) ? (num_tasks - done) : BATCH_SIZE;
+    for (int i = 0; i < batch; i++) {
+      tids[i] = uthread_create(tiny_task, (void*)(done + i));
+      if (tids[i] < 0) {
+        cerr << "Error: uthread_create" << endl;
+        exit(1);
+      }
+    }
+    for (int i = 0; i < batch; i++) {
+      void *result;
+      uthread_join(tids[i], &result);
+      sum += (long)result;
+    }
+  }
+
+  return sum;
+}
+
+// Run num_tasks tasks by submitting them to the pool
+long run_with_pool(ThreadPool &pool, long num_tasks) {
+  int handles[BATCH_SIZE];
+  long sum = 0;
+
+  for (long done = 0; done < num_tasks; done += BATCH_SIZE) {
+    int batch = (num_tasks - done < BATCH_SIZE) ? (num_tasks - done) : BATCH_SIZE;
+    for (int i = 0; i < batch; i++) {
+      handles[i] = pool.submit(tiny_task, (void*)(done + i));
+      if (handles[i] < 0) {
+        cerr << "Error: ThreadPool::submit" << endl;
+        exit(1);
+      }
+    }
+    for (int i = 0; i < batch; i++) {
+      void *result;
+      pool.wait(handles[i], &result);
+      sum += (long)result;
+    }
+  }
+
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./pool-performance <num_tasks> <num_workers>" << endl;
+    cerr << "Example: ./pool-performance 1000000 4" << endl;
+    exit(1);
+  }
+
+  long num_tasks = atol(argv[1]);
+  int num_workers = atoi(argv[2]);
+
+  if (num_workers < 1 || num_workers > 99) {
+    cerr << "Error: <num_workers> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // Sum of (i + 1) for i in [0, num_tasks)
+  long expected = num_tasks * (num_tasks + 1) / 2;
+
+  auto start = chrono::steady_clock::now();
+  long sum = run_with_threads(num_tasks);
+  auto end = chrono::steady_clock::now();
+  double thread_secs = chrono::duration<double>(end - start).count();
+  if (sum != expected) {
+    cerr << "Error: uthread_create/uthread_join results are wrong" << endl;
+    exit(1);
+  }
+
+  {
+    ThreadPool pool(num_workers);
+
+    start = chrono::steady_clock::now();
+    sum = run_with_pool(pool, num_tasks);
+    end = chrono::steady_clock::now();
+  }
+  double pool_secs = chrono::duration<double>(end - start).count();
+  if (sum != expected) {
+    cerr << "Error: ThreadPool results are wrong" << endl;
+    exit(1);
+  }
+
+  cout << "uthread_create/join: " << thread_secs << " s ("
+       << (num_tasks / thread_secs) << " tasks/s)" << endl;
+  cout << "ThreadPool (" << num_workers << " workers): " << pool_secs << " s ("
+       << (num_tasks / pool_secs) << " tasks/s)" << endl;
+
+  return 0;
+}
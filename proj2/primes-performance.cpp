@@ -0,0 +1,121 @@
+#include "uthread.h"
+#include "Parallel.h"
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+
+// testcase-4's trial division. Work per number grows with the number, so
+// equal slices of the range are far from equal amounts of work
+bool is_prime(long n) {
+  if (n < 2)
+    return false;
+  for (long j = 2; j <= n / 2; j++) {
+    if (n % j == 0)
+      return false;
+  }
+  return true;
+}
+
+long count_primes(long begin, long end) {
+  long count = 0;
+  for (long i = begin; i < end; i++) {
+    if (is_prime(i))
+      count++;
+  }
+  return count;
+}
+
+// Static split: one thread per slice, counts returned through heap buffers
+long numbers_per_thread;
+
+void* worker(void *arg) {
+  long begin = (long)arg * numbers_per_thread;
+  // NOTE: Parent thread must deallocate
+  long *num_primes = new long;
+  *num_primes = count_primes(begin, begin + numbers_per_thread);
+  return num_primes;
+}
+
+long primes_by_hand(long limit, int thread_count) {
+  int *threads = new int[thread_count];
+  numbers_per_thread = limit / thread_count;
+
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = uthread_create(worker, (void*)(long)i);
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  long counter = 0;
+  for (int i = 0; i < thread_count; i++) {
+    long *num_primes = nullptr;
+    uthread_join(threads[i], (void**)&num_primes);
+    counter += *num_primes;
+    delete num_primes;
+  }
+
+  delete[] threads;
+  return counter;
+}
+
+long primes_by_reduce(long limit, long grain) {
+  return uthread::parallel_reduce(uthread::range{0, limit}, grain, 0l,
+    [](uthread::range chunk, long count) {
+      return count + count_primes(chunk.begin, chunk.end);
+    },
+    [](long a, long b) { return a + b; });
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    cerr << "Usage: ./primes-performance <limit> <threads> <grain>" << endl;
+    cerr << "Example: ./primes-performance 100000 8 500" << endl;
+    exit(1);
+  }
+
+  long limit = atol(argv[1]);
+  int thread_count = atoi(argv[2]);
+  long grain = atol(argv[3]);
+
+  if (thread_count < 1 || thread_count > PARALLEL_WORKERS_MAX) {
+    cerr << "Error: <threads> must be between 1 and " << PARALLEL_WORKERS_MAX << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  limit -= limit % thread_count;
+
+  auto start = chrono::steady_clock::now();
+  long hand_count = primes_by_hand(limit, thread_count);
+  auto end = chrono::steady_clock::now();
+  double hand_secs = chrono::duration<double>(end - start).count();
+
+  uthread::set_parallel_workers(thread_count);
+  start = chrono::steady_clock::now();
+  long reduce_count = primes_by_reduce(limit, grain);
+  end = chrono::steady_clock::now();
+  double reduce_secs = chrono::duration<double>(end - start).count();
+
+  if (hand_count != reduce_count) {
+    cerr << "Error: prime counts differ" << endl;
+    exit(1);
+  }
+
+  cout << "Primes below " << limit << ": " << reduce_count << endl;
+  cout << "create/join:     " << hand_secs << " s" << endl;
+  cout << "parallel_reduce: " << reduce_secs << " s" << endl;
+
+  return 0;
+}
@@ -0,0 +1,227 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "SpinLock.h"
+#include "CondVar.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define ACCOUNT_COUNT 16
+#define AUDIT_PERCENT 5
+#define LEDGER_ROUNDS 1000
+#define HOLD_COLUMNS 8  /* hold-time histogram columns in the CSV dump */
+
+// Bank with a named lock per job, so the profile shows which one is hot.
+// Transfers hold accounts_lock for a while, audits take audit_lock (a
+// spinlock) briefly and the unnamed log_lock is not profiled at all
+static long accounts[ACCOUNT_COUNT];
+static long audits = 0;
+static long log_lines = 0;
+
+static Lock accounts_lock("bank.accounts");
+static SpinLock audit_lock("bank.audit");
+static Lock log_lock;
+
+// Two clerks take turns on the ledger through a (Hoare) condition variable,
+// counting every time they get the lock: from lock(), coming back from
+// wait() and getting it back after a signal handed it to the other clerk
+static Lock ledger_lock("bank.ledger");
+static CondVar ledger_cv;
+static int ledger_turn = 0;
+static int ledger_waiting = 0;
+static unsigned long ledger_acquisitions = 0;
+
+static int ops_per_thread;
+
+// Burn CPU for usecs without giving up the thread
+void spin_for(long usecs) {
+  auto end = chrono::steady_clock::now() + chrono::microseconds(usecs);
+  while (chrono::steady_clock::now() < end) {
+  }
+}
+
+void* teller(void *arg) {
+  unsigned int seed = (unsigned int)(long)arg;
+  for (int i = 0; i < ops_per_thread; i++) {
+    if ((int)(rand_r(&seed) % 100) < AUDIT_PERCENT) {
+      audit_lock.lock();
+      audits++;
+      audit_lock.unlock();
+    }
+    else {
+      accounts_lock.lock();
+      accounts[rand_r(&seed) % ACCOUNT_COUNT]--;
+      spin_for(20);
+      accounts[rand_r(&seed) % ACCOUNT_COUNT]++;
+      accounts_lock.unlock();
+    }
+
+    log_lock.lock();
+    log_lines++;
+    log_lock.unlock();
+  }
+  return nullptr;
+}
+
+void* clerk(void *arg) {
+  int me = (int)(long)arg;
+  for (int i = 0; i < LEDGER_ROUNDS; i++) {
+    ledger_lock.lock();
+    ledger_acquisitions++;
+    while (ledger_turn != me) {
+      ledger_waiting++;
+      ledger_cv.wait(ledger_lock);
+      ledger_waiting--;
+      ledger_acquisitions++;
+    }
+    ledger_turn = 1 - me;
+    if (ledger_waiting > 0) {
+      ledger_acquisitions++;
+    }
+    ledger_cv.signal();
+    ledger_lock.unlock();
+  }
+  return nullptr;
+}
+
+// Give up on the ledger lock held by main
+void* impatient(void *arg) {
+  if (ledger_lock.try_lock_for(chrono::milliseconds(1))) {
+    cerr << "Error: try_lock_for got a held lock" << endl;
+    exit(1);
+  }
+  return nullptr;
+}
+
+// Check the ledger's row of the CSV dump against what the clerks counted
+void check_ledger() {
+  FILE *csv = tmpfile();
+  if (csv == nullptr || uthread_dump_lock_stats(csv, LOCK_STATS_CSV, LOCK_SORT_NAME) != 0) {
+    cerr << "Error: uthread_dump_lock_stats" << endl;
+    exit(1);
+  }
+  rewind(csv);
+
+  char line[1024];
+  while (fgets(line, sizeof(line), csv) != nullptr) {
+    if (strncmp(line, "bank.ledger,", 12) != 0) {
+      continue;
+    }
+    // lock,acquisitions,contended,timeouts,wait_ns,max_wait_ns,holds...
+    char *field = line + 12;
+    unsigned long acquisitions = strtoul(field, &field, 10);
+    strtoul(field + 1, &field, 10);
+    unsigned long timeouts = strtoul(field + 1, &field, 10);
+    unsigned long wait_ns = strtoul(field + 1, &field, 10);
+    strtoul(field + 1, &field, 10);
+    unsigned long hold_total = 0;
+    for (int i = 0; i < HOLD_COLUMNS; i++) {
+      hold_total += strtoul(field + 1, &field, 10);
+    }
+
+    if (acquisitions != ledger_acquisitions || hold_total != acquisitions) {
+      cerr << "Error: ledger profile counted " << acquisitions << " acquisitions and "
+           << hold_total << " holds, the clerks took the lock " << ledger_acquisitions
+           << " times" << endl;
+      exit(1);
+    }
+    if (timeouts != 1 || wait_ns < 1000000) {
+      cerr << "Error: the timed out try_lock_for was not counted as a wait" << endl;
+      exit(1);
+    }
+    fclose(csv);
+    return;
+  }
+
+  cerr << "Error: bank.ledger missing from the profile" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    cerr << "Usage: ./profile-testcase <threads> <ops per thread> <table|csv>" << endl;
+    cerr << "Example: ./profile-testcase 8 2000 table" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[1]);
+  ops_per_thread = atoi(argv[2]);
+  LockStatsFormat format;
+  if (strcmp(argv[3], "table") == 0) {
+    format = LOCK_STATS_TABLE;
+  }
+  else if (strcmp(argv[3], "csv") == 0) {
+    format = LOCK_STATS_CSV;
+  }
+  else {
+    cerr << "Error: format must be table or csv" << endl;
+    exit(1);
+  }
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  uthread_profile_locks(1);
+
+  vector<int> threads;
+  for (int i = 0; i < thread_count; i++) {
+    int tid = uthread_create(teller, (void*)(long)(i + 1));
+    if (tid < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+    threads.push_back(tid);
+  }
+
+  for (int tid : threads) {
+    uthread_join(tid, nullptr);
+  }
+
+  int clerks[2];
+  for (int i = 0; i < 2; i++) {
+    clerks[i] = uthread_create(clerk, (void*)(long)i);
+  }
+  for (int i = 0; i < 2; i++) {
+    uthread_join(clerks[i], nullptr);
+  }
+
+  ledger_lock.lock();
+  ledger_acquisitions++;
+  int impatient_tid = uthread_create(impatient, nullptr);
+  uthread_join(impatient_tid, nullptr);
+  ledger_lock.unlock();
+
+  uthread_profile_locks(0);
+  check_ledger();
+
+  long total = 0;
+  for (int i = 0; i < ACCOUNT_COUNT; i++) {
+    total += accounts[i];
+  }
+  if (total != 0 || log_lines != (long)thread_count * ops_per_thread) {
+    cerr << "Error: locks did not protect the bank" << endl;
+    exit(1);
+  }
+
+  // Hottest lock first
+  if (uthread_dump_lock_stats(stdout, format, LOCK_SORT_WAIT) != 0) {
+    cerr << "Error: uthread_dump_lock_stats" << endl;
+    exit(1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include "uthread.h"
+#include "Lock.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define MAX_TRACE 1000000
+#define WORK_SPINS 20000
+
+// Order in which the threads got the lock
+static Lock trace_lock;
+static int trace[MAX_TRACE];
+static int trace_length = 0;
+
+static int iterations = 0;
+
+void* worker(void *arg) {
+  int tid = uthread_self();
+  unsigned int seed = (unsigned long)arg;
+
+  for (int i = 0; i < iterations; i++) {
+    // Spin for a while so the timer preempts threads at arbitrary points
+    volatile unsigned long work = 0;
+    int spins = rand_r(&seed) % WORK_SPINS;
+    for (int j = 0; j < spins; j++) {
+      work += j;
+    }
+
+    trace_lock.lock();
+    assert(trace_length < MAX_TRACE);
+    trace[trace_length++] = tid;
+    trace_lock.unlock();
+  }
+
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 5) {
+    cerr << "Usage: ./replay-testcase <threads> <iterations> [record|replay <log>]" << endl;
+    cerr << "Example: ./replay-testcase 8 10000 record schedule.log" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[1]);
+  iterations = atoi(argv[2]);
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+  if (iterations < 1 || (long)thread_count * iterations > MAX_TRACE) {
+    cerr << "Error: <threads> * <iterations> must be between 1 and " << MAX_TRACE << endl;
+    exit(1);
+  }
+
+  if (argc == 5) {
+    int ret;
+    if (strcmp(argv[3], "record") == 0) {
+      ret = uthread_record_schedule(argv[4]);
+    }
+    else if (strcmp(argv[3], "replay") == 0) {
+      ret = uthread_replay_schedule(argv[4]);
+    }
+    else {
+      cerr << "Error: mode must be record or replay" << endl;
+      exit(1);
+    }
+    if (ret != 0) {
+      cerr << "Error: unable to " << argv[3] << " " << argv[4] << endl;
+      exit(1);
+    }
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  int *threads = new int[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = uthread_create(worker, (void *)(unsigned long)(i + 1));
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  for (int i = 0; i < thread_count; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+  delete[] threads;
+
+  // Identical interleavings give identical traces, so compare fingerprints
+  // across runs
+  assert(trace_length == thread_count * iterations);
+  unsigned long hash = 14695981039346656037UL;
+  int handovers = 0;
+  for (int i = 0; i < trace_length; i++) {
+    hash = (hash ^ trace[i]) * 1099511628211UL;
+    if (i > 0 && trace[i] != trace[i - 1]) {
+      handovers++;
+    }
+  }
+
+  uthread_stats_t stats;
+  uthread_get_stats(&stats);
+  cout << "Lock handovers: " << handovers << endl;
+  cout << "Context switches: " << stats.switches << endl;
+  cout << "Trace fingerprint: " << hex << hash << dec << endl;
+
+  return 0;
+}
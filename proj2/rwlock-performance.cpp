@@ -0,0 +1,161 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "RWLock.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define ACCOUNT_COUNT 1000
+#define INITIAL_BALANCE 100
+#define READ_USECS 20        // Extra work per read inside the critical section
+
+// locks-testcase-bank's accounts, mostly read. A read sums every balance,
+// a write moves money between two accounts
+static int accounts[ACCOUNT_COUNT];
+
+static bool use_rwlock;
+static Lock bank_lock;
+static RWLock bank_rwlock;
+
+static int ops_per_thread;
+static int read_percent;
+
+// Burn CPU for usecs without giving up the thread
+void spin_for(long usecs) {
+  auto end = chrono::steady_clock::now() + chrono::microseconds(usecs);
+  while (chrono::steady_clock::now() < end) {
+  }
+}
+
+void read_total() {
+  if (use_rwlock) {
+    bank_rwlock.lock_shared();
+  }
+  else {
+    bank_lock.lock();
+  }
+
+  long total = 0;
+  for (int i = 0; i < ACCOUNT_COUNT; i++) {
+    total += accounts[i];
+  }
+  spin_for(READ_USECS);
+  assert(total == (long)ACCOUNT_COUNT * INITIAL_BALANCE);
+
+  if (use_rwlock) {
+    bank_rwlock.unlock_shared();
+  }
+  else {
+    bank_lock.unlock();
+  }
+}
+
+void transfer(int from, int to) {
+  if (use_rwlock) {
+    bank_rwlock.lock();
+  }
+  else {
+    bank_lock.lock();
+  }
+
+  accounts[from]--;
+  accounts[to]++;
+
+  if (use_rwlock) {
+    bank_rwlock.unlock();
+  }
+  else {
+    bank_lock.unlock();
+  }
+}
+
+void* worker(void *arg) {
+  unsigned int seed = (unsigned int)(long)arg;
+  for (int i = 0; i < ops_per_thread; i++) {
+    if ((int)(rand_r(&seed) % 100) < read_percent) {
+      read_total();
+    }
+    else {
+      transfer(rand_r(&seed) % ACCOUNT_COUNT, rand_r(&seed) % ACCOUNT_COUNT);
+    }
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 5) {
+    cerr << "Usage: ./rwlock-performance <lock|rwlock> <threads> <read percent> <ops per thread>" << endl;
+    cerr << "Example: ./rwlock-performance rwlock 16 90 10000" << endl;
+    exit(1);
+  }
+
+  if (strcmp(argv[1], "lock") == 0) {
+    use_rwlock = false;
+  }
+  else if (strcmp(argv[1], "rwlock") == 0) {
+    use_rwlock = true;
+  }
+  else {
+    cerr << "Error: lock must be lock or rwlock" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[2]);
+  read_percent = atoi(argv[3]);
+  ops_per_thread = atoi(argv[4]);
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+  if (read_percent < 0 || read_percent > 100) {
+    cerr << "Error: <read percent> must be between 0 and 100" << endl;
+    exit(1);
+  }
+
+  for (int i = 0; i < ACCOUNT_COUNT; i++) {
+    accounts[i] = INITIAL_BALANCE;
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  auto start = chrono::steady_clock::now();
+
+  vector<int> threads;
+  for (int i = 0; i < thread_count; i++) {
+    int tid = uthread_create(worker, (void*)(long)(i + 1));
+    if (tid < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+    threads.push_back(tid);
+  }
+
+  for (int tid : threads) {
+    uthread_join(tid, nullptr);
+  }
+
+  auto end = chrono::steady_clock::now();
+  double secs = chrono::duration<double>(end - start).count();
+  long ops = (long)thread_count * ops_per_thread;
+
+  uthread_stats_t stats;
+  uthread_get_stats(&stats);
+
+  cout << argv[1] << " " << read_percent << "/" << 100 - read_percent << ": "
+       << ops / secs << " ops/sec, " << (double)stats.switches / ops
+       << " switches/op" << endl;
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "uthread.h"
+#include "RWLock.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+#define ACTOR_COUNT 6
+#define SETTLE_YIELDS 20
+#define STREAM_READERS 5
+
+// Upgrade, downgrade and reader preference. Actor threads run one RWLock call
+// at a time as the main thread tells them to, and the main thread checks
+// which calls have returned and which are still blocked after every step
+enum Command {NONE, LOCK_SHARED, UNLOCK_SHARED, LOCK, UNLOCK, UPGRADE, DOWNGRADE, EXIT};
+
+struct Actor {
+  volatile int command;   // Call to make, NONE once it has returned
+  bool result;            // What upgrade() returned
+  int tid;
+};
+
+static RWLock *rw = nullptr;
+static Actor actors[ACTOR_COUNT];
+
+void fail(const char *message) {
+  cerr << "Error: " << message << endl;
+  exit(1);
+}
+
+void* actor(void *arg) {
+  Actor &self = actors[(long)arg];
+  while (true) {
+    while (self.command == NONE) {
+      uthread_yield();
+    }
+    switch (self.command) {
+    case LOCK_SHARED:   rw->lock_shared(); break;
+    case UNLOCK_SHARED: rw->unlock_shared(); break;
+    case LOCK:          rw->lock(); break;
+    case UNLOCK:        rw->unlock(); break;
+    case UPGRADE:       self.result = rw->upgrade(); break;
+    case DOWNGRADE:     rw->downgrade(); break;
+    case EXIT:          return nullptr;
+    }
+    self.command = NONE;
+  }
+}
+
+// Let every thread that can run get as far as it can
+static void settle() {
+  for (int i = 0; i < SETTLE_YIELDS; i++) {
+    uthread_yield();
+  }
+}
+
+// Have actor a make a call, and wait until it returned or blocked
+static void send(int a, Command command) {
+  if (actors[a].command != NONE) {
+    fail("actor is still blocked in its last call");
+  }
+  actors[a].command = command;
+  settle();
+}
+
+static bool done(int a) {
+  return actors[a].command == NONE;
+}
+
+static void expectDone(int a, const char *message) {
+  if (!done(a)) {
+    fail(message);
+  }
+}
+
+static void expectBlocked(int a, const char *message) {
+  if (done(a)) {
+    fail(message);
+  }
+}
+
+static void start(RWLock *lock) {
+  rw = lock;
+  for (long i = 0; i < ACTOR_COUNT; i++) {
+    actors[i].command = NONE;
+    actors[i].tid = uthread_create(actor, (void*)i);
+    if (actors[i].tid < 0) {
+      fail("uthread_create");
+    }
+  }
+}
+
+static void finish() {
+  for (int i = 0; i < ACTOR_COUNT; i++) {
+    send(i, EXIT);
+    uthread_join(actors[i].tid, nullptr);
+  }
+}
+
+// An upgrade waits for the other reader to leave, a second upgrade fails and
+// keeps its shared hold, and a downgrade lets the waiting reader in
+static void testUpgrade() {
+  RWLock lock;
+  start(&lock);
+  send(0, LOCK_SHARED);
+  send(1, LOCK_SHARED);
+  expectDone(1, "two readers could not share the lock");
+
+  send(0, UPGRADE);
+  expectBlocked(0, "upgrade did not wait for the other reader");
+
+  send(1, UPGRADE);
+  expectDone(1, "a second upgrade blocked");
+  if (actors[1].result) {
+    fail("a second concurrent upgrade succeeded");
+  }
+
+  // Nobody gets in while a reader is upgrading
+  send(2, LOCK_SHARED);
+  expectBlocked(2, "a reader got in while another reader was upgrading");
+
+  send(1, UNLOCK_SHARED);
+  expectDone(0, "upgrade did not finish once the other reader left");
+  if (!actors[0].result) {
+    fail("upgrade failed");
+  }
+  expectBlocked(2, "a reader got in while the upgraded thread held the lock");
+
+  send(0, DOWNGRADE);
+  expectDone(2, "downgrade did not let the waiting reader in");
+
+  send(0, UNLOCK_SHARED);
+  send(2, UNLOCK_SHARED);
+
+  // A lone reader upgrades right away
+  send(3, LOCK_SHARED);
+  send(3, UPGRADE);
+  expectDone(3, "a lone reader had to wait to upgrade");
+  send(3, UNLOCK);
+  finish();
+}
+
+// A downgrade lets the readers waiting on the writer in, unless writers are
+// preferred and another writer is queued, which then goes first
+static void testDowngrade(bool prefer_writers) {
+  RWLock lock(prefer_writers);
+  start(&lock);
+  send(0, LOCK);
+  send(1, LOCK_SHARED);
+  expectBlocked(1, "a reader got in while a writer held the lock");
+  send(2, LOCK);
+  expectBlocked(2, "two writers held the lock");
+
+  send(0, DOWNGRADE);
+  if (prefer_writers) {
+    expectBlocked(1, "downgrade let a reader in ahead of a queued writer");
+    send(0, UNLOCK_SHARED);
+    expectDone(2, "the queued writer did not get the lock after the downgrade");
+    expectBlocked(1, "a reader got in while a writer held the lock");
+    send(2, UNLOCK);
+    expectDone(1, "the reader did not get in after the writer left");
+    send(1, UNLOCK_SHARED);
+  }
+  else {
+    expectDone(1, "downgrade did not let the waiting reader in");
+    expectBlocked(2, "a writer got in while readers held the lock");
+    send(0, UNLOCK_SHARED);
+    expectBlocked(2, "a writer got in while a reader held the lock");
+    send(1, UNLOCK_SHARED);
+    expectDone(2, "the writer did not get the lock after the readers left");
+    send(2, UNLOCK);
+  }
+  finish();
+}
+
+// Preferring readers, a queued writer waits while readers keep the lock busy,
+// each coming in before the one before leaves, until the stream ends
+static void testReaderStream() {
+  RWLock lock(false);
+  start(&lock);
+  const int writer = ACTOR_COUNT - 1;
+  const int readers = ACTOR_COUNT - 1;
+
+  send(0, LOCK_SHARED);
+  send(writer, LOCK);
+  expectBlocked(writer, "a writer got in while a reader held the lock");
+
+  for (int i = 1; i < STREAM_READERS; i++) {
+    send(i % readers, LOCK_SHARED);
+    expectDone(i % readers, "a reader waited for a queued writer although readers are preferred");
+    send((i - 1) % readers, UNLOCK_SHARED);
+    expectBlocked(writer, "a writer got in while a reader held the lock");
+  }
+
+  send((STREAM_READERS - 1) % readers, UNLOCK_SHARED);
+  expectDone(writer, "the writer did not get the lock after the stream of readers ended");
+  send(writer, UNLOCK);
+  finish();
+}
+
+// Preferring writers, the same stream stops at the queued writer
+static void testWriterPreference() {
+  RWLock lock;
+  start(&lock);
+  send(0, LOCK_SHARED);
+  send(2, LOCK);
+  send(1, LOCK_SHARED);
+  expectBlocked(1, "a reader got in ahead of a queued writer");
+
+  send(0, UNLOCK_SHARED);
+  expectDone(2, "the queued writer did not get the lock");
+  expectBlocked(1, "a reader got in while a writer held the lock");
+  send(2, UNLOCK);
+  expectDone(1, "the reader did not get in after the writer left");
+  send(1, UNLOCK_SHARED);
+  finish();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: ./rwlock-testcase <rounds>" << endl;
+    cerr << "Example: ./rwlock-testcase 100" << endl;
+    exit(1);
+  }
+
+  int rounds = atoi(argv[1]);
+  if (rounds < 1) {
+    cerr << "Error: <rounds> must be positive" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  for (int round = 0; round < rounds; round++) {
+    testUpgrade();
+    testDowngrade(true);
+    testDowngrade(false);
+    testReaderStream();
+    testWriterPreference();
+  }
+
+  cout << "RWLock upgrade, downgrade and preference checks passed " << rounds << " times" << endl;
+  return 0;
+}
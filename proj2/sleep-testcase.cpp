@@ -0,0 +1,113 @@
+#include "uthread.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+#define SLEEP_USECS 100000
+#define SLEEPS_PER_THREAD 10
+
+// NOTE: Build with the Makefile target, which links with $(WRAP_SYSCALLS) so
+//       the plain usleep/read/write calls below only park the calling thread
+
+static int pipe_fds[2];
+static volatile bool sleepers_done = false;
+static long busy_count = 0;
+
+// Sleep over and over, which would stall every thread without the wrappers
+void* sleeper(void *arg) {
+  for (int i = 0; i < SLEEPS_PER_THREAD; i++) {
+    usleep(SLEEP_USECS);
+  }
+  return nullptr;
+}
+
+// Send a message down the pipe between naps
+void* writer(void *arg) {
+  for (int i = 0; i < SLEEPS_PER_THREAD; i++) {
+    usleep(SLEEP_USECS);
+    int ret = write(pipe_fds[1], &i, sizeof(i));
+    assert(ret == sizeof(i));
+  }
+  return nullptr;
+}
+
+// Block in read() on the empty pipe until the writer sends something
+void* reader(void *arg) {
+  for (int i = 0; i < SLEEPS_PER_THREAD; i++) {
+    int message;
+    int ret = read(pipe_fds[0], &message, sizeof(message));
+    assert(ret == sizeof(message));
+    assert(message == i);
+  }
+  return nullptr;
+}
+
+// Keep computing the whole time to show the CPU never sits idle
+void* busy(void *arg) {
+  while (!sleepers_done) {
+    busy_count++;
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: ./sleep-testcase <num_sleepers>" << endl;
+    cerr << "Example: ./sleep-testcase 50" << endl;
+    exit(1);
+  }
+
+  int sleeper_count = atoi(argv[1]);
+
+  if (sleeper_count < 1 || sleeper_count > 96) {
+    cerr << "Error: <num_sleepers> must be between 1 and 96" << endl;
+    exit(1);
+  }
+
+  if (pipe(pipe_fds) != 0) {
+    cerr << "Error: pipe" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  auto start = chrono::steady_clock::now();
+
+  int *sleepers = new int[sleeper_count];
+  if (uthread_create_many(sleeper_count, sleeper, nullptr, sleepers) != 0) {
+    cerr << "Error: uthread_create_many" << endl;
+    exit(1);
+  }
+  int reader_tid = uthread_create(reader, nullptr);
+  int writer_tid = uthread_create(writer, nullptr);
+  int busy_tid = uthread_create(busy, nullptr);
+
+  for (int i = 0; i < sleeper_count; i++) {
+    uthread_join(sleepers[i], nullptr);
+  }
+  uthread_join(reader_tid, nullptr);
+  uthread_join(writer_tid, nullptr);
+  sleepers_done = true;
+  uthread_join(busy_tid, nullptr);
+
+  auto end = chrono::steady_clock::now();
+  double secs = chrono::duration<double>(end - start).count();
+  delete[] sleepers;
+
+  // Sleeping in the kernel would take sleeper_count times longer
+  cout << sleeper_count << " threads slept " << SLEEPS_PER_THREAD << " x "
+       << (SLEEP_USECS / 1000) << " ms each in " << secs << " s" << endl;
+  cout << "Busy thread counted to " << busy_count << " in the meantime" << endl;
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "uthread.h"
+#include "Spawn.h"
+#include "Lock.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+
+static Lock total_lock;
+static long total = 0;
+
+void add_range(long begin, long end, const string &name) {
+  long local_sum = 0;
+  for (long i = begin; i < end; i++) {
+    local_sum += i;
+  }
+
+  total_lock.lock();
+  total += local_sum;
+  cout << name << " summed [" << begin << ", " << end << ")" << endl;
+  total_lock.unlock();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./spawn-testcase <count> <threads>" << endl;
+    cerr << "Example: ./spawn-testcase 10000000 8" << endl;
+    exit(1);
+  }
+
+  long count = atol(argv[1]);
+  int thread_count = atoi(argv[2]);
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  int *threads = new int[thread_count];
+  long per_thread = count / thread_count;
+
+  // Even threads get a capturing lambda, odd threads a function plus
+  // arguments. Both live on the new thread's stack, nothing is boxed
+  for (int i = 0; i < thread_count; i++) {
+    long begin = i * per_thread;
+    long end = (i == thread_count - 1) ? count : begin + per_thread;
+    string name = "Thread #" + to_string(i);
+
+    if (i % 2 == 0) {
+      threads[i] = uthread::spawn([begin, end, name]() {
+        add_range(begin, end, name);
+      });
+    }
+    else {
+      threads[i] = uthread::spawn(add_range, begin, end, name);
+    }
+
+    if (threads[i] < 0) {
+      cerr << "Error: uthread::spawn" << endl;
+      exit(1);
+    }
+  }
+
+  // Wait for all threads to complete
+  for (int i = 0; i < thread_count; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+
+  delete[] threads;
+
+  assert(total == count * (count - 1) / 2);
+  cout << "Total: " << total << endl;
+
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include "CondVar.h"
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 using namespace std;
@@ -19,8 +20,13 @@ static int head = 0;
 static int tail = 0;
 static int item_count = 0;
 
-// Shared buffer synchronization
+// Shared buffer synchronization, one of the spinlocks picked on the command line
+enum SpinLockKind { TAS, TTAS, TICKET, MCS };
+static SpinLockKind spinlock_kind = TAS;
 static SpinLock slock;
+static TTASSpinLock ttas_lock;
+static TicketSpinLock ticket_lock;
+static MCSSpinLock mcs_lock;
 static Lock cvLock;
 static CondVar need_space_cv;
 static CondVar need_item_cv;
@@ -56,10 +62,28 @@ void assert_buffer_invariants() {
   assert(produced_count >= consumed_count);
 }
 
+void lock_buffer() {
+  switch (spinlock_kind) {
+  case TAS: slock.lock(); break;
+  case TTAS: ttas_lock.lock(); break;
+  case TICKET: ticket_lock.lock(); break;
+  case MCS: mcs_lock.lock(); break;
+  }
+}
+
+void unlock_buffer() {
+  switch (spinlock_kind) {
+  case TAS: slock.unlock(); break;
+  case TTAS: ttas_lock.unlock(); break;
+  case TICKET: ticket_lock.unlock(); break;
+  case MCS: mcs_lock.unlock(); break;
+  }
+}
+
 void* producer(void *arg) {
   while (true) {
 
-    slock.lock();
+    lock_buffer();
 
     // Make sure synchronization is working correctly
     assert(!producer_in_critical_section);
@@ -74,7 +98,7 @@ void* producer(void *arg) {
 
     producer_in_critical_section = false;
 
-    slock.unlock();
+    unlock_buffer();
 
     // Randomly give another thread a chance
     if ((rand() % 100) < RANDOM_YIELD_PERCENT) {
@@ -88,7 +112,7 @@ void* producer(void *arg) {
 void* consumer(void *arg) {
   while (true) {
     
-    slock.lock();
+    lock_buffer();
 
     // Make sure synchronization is working correctly
     assert(!consumer_in_critical_section);
@@ -111,7 +135,7 @@ void* consumer(void *arg) {
 
     consumer_in_critical_section = false;
 
-    slock.unlock();
+    unlock_buffer();
 
     // Randomly give another thread a chance
     if ((rand() % 100) < RANDOM_YIELD_PERCENT) {
@@ -123,12 +147,31 @@ void* consumer(void *arg) {
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    cerr << "Usage: ./uthread-sync-demo <num_producer> <num_consumer>" << endl;
-    cerr << "Example: ./uthread-sync-demo 20 20" << endl;
+  if (argc != 3 && argc != 4) {
+    cerr << "Usage: ./spinlock-performance <num_producer> <num_consumer> [tas|ttas|ticket|mcs]" << endl;
+    cerr << "Example: ./spinlock-performance 20 20 mcs" << endl;
     exit(1);
   }
 
+  if (argc == 4) {
+    if (strcmp(argv[3], "tas") == 0) {
+      spinlock_kind = TAS;
+    }
+    else if (strcmp(argv[3], "ttas") == 0) {
+      spinlock_kind = TTAS;
+    }
+    else if (strcmp(argv[3], "ticket") == 0) {
+      spinlock_kind = TICKET;
+    }
+    else if (strcmp(argv[3], "mcs") == 0) {
+      spinlock_kind = MCS;
+    }
+    else {
+      cerr << "Error: spinlock must be tas, ttas, ticket or mcs" << endl;
+      exit(1);
+    }
+  }
+
   int producer_count = atoi(argv[1]);
   int consumer_count = atoi(argv[2]);
 
@@ -0,0 +1,91 @@
+#include "uthread.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define FRAME_BYTES 256
+#define FRAMES_PER_THREAD 4
+
+// Use about depth * FRAME_BYTES of stack
+int recurse(int depth) {
+  volatile char frame[FRAME_BYTES];
+  memset((char *)frame, depth, sizeof(frame));
+  if (depth == 0) {
+    uthread_yield();
+    return frame[0];
+  }
+  return recurse(depth - 1) + frame[FRAME_BYTES - 1];
+}
+
+void* worker(void *arg) {
+  long depth = (long)arg;
+  recurse(depth);
+
+  // The high-water mark stays put once the calls have returned
+  int usage = uthread_get_stack_usage(uthread_self());
+  assert(usage >= depth * FRAME_BYTES);
+  assert(usage <= STACK_SIZE);
+  return (void *)(long)usage;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: ./stack-testcase <threads>" << endl;
+    cerr << "Example: ./stack-testcase 10" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[1]);
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Must come before uthread_init
+  int ret = uthread_profile_stacks();
+  if (ret != 0) {
+    cerr << "Error: uthread_profile_stacks" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // Thread i goes i * FRAMES_PER_THREAD frames deep, wrapping around before
+  // it would overflow its stack
+  int max_depth = (STACK_SIZE / 2) / FRAME_BYTES;
+  int *threads = new int[thread_count];
+  long *depths = new long[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    depths[i] = (i * FRAMES_PER_THREAD) % max_depth;
+    threads[i] = uthread_create(worker, (void *)depths[i]);
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+      exit(1);
+    }
+  }
+
+  // A fresh thread has barely touched its stack
+  assert(uthread_get_stack_usage(threads[0]) < STACK_SIZE / 4);
+
+  for (int i = 0; i < thread_count; i++) {
+    void *usage;
+    uthread_join(threads[i], &usage);
+    cout << "Thread #" << i << " went " << depths[i] << " frames deep, used "
+         << (long)usage << " bytes" << endl;
+  }
+
+  delete[] threads;
+  delete[] depths;
+
+  // The histogram of every thread's stack usage is printed at exit
+  return 0;
+}
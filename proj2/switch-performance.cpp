@@ -0,0 +1,133 @@
+#include "uthread.h"
+#include <cassert>
+#include <cfenv>
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+#define FP_VECTOR_SIZE 64
+
+static int yields_per_thread = 0;
+static int thread_count = 0;
+static int *threads = nullptr;
+static bool *finished = nullptr;
+
+// Do nothing but hand the CPU to the next ready thread
+void* yielder(void *arg) {
+  for (int i = 0; i < yields_per_thread; i++) {
+    uthread_yield();
+  }
+  return nullptr;
+}
+
+// Do some vectorizable double math under a rounding mode of its own between
+// yields, which only works if every thread keeps its own FP control state
+void* fp_yielder(void *arg) {
+  static const int rounding_modes[] = {FE_TONEAREST, FE_UPWARD, FE_DOWNWARD, FE_TOWARDZERO};
+  int mode = rounding_modes[(long)arg % 4];
+  fesetround(mode);
+
+  double x[FP_VECTOR_SIZE], y[FP_VECTOR_SIZE];
+  for (int i = 0; i < FP_VECTOR_SIZE; i++) {
+    x[i] = i * 0.5;
+    y[i] = 1.0;
+  }
+  for (int i = 0; i < yields_per_thread; i++) {
+    for (int j = 0; j < FP_VECTOR_SIZE; j++) {
+      y[j] = y[j] * 0.999 + x[j];
+    }
+    uthread_yield();
+    assert(fegetround() == mode);
+  }
+
+  fesetround(FE_TONEAREST);
+  return (void *)(long)(y[0] > 0);
+}
+
+// Hand the CPU straight to the next thread in the ring, like a pipeline stage
+// passing work downstream
+void* handoff(void *arg) {
+  long index = (long)arg;
+  long next = (index + 1) % thread_count;
+  for (int i = 0; i < yields_per_thread; i++) {
+    if (finished[next] || uthread_yield_to(threads[next]) != 0) {
+      uthread_yield();
+    }
+  }
+  finished[index] = true;
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    cerr << "Usage: ./switch-performance <num_threads> <yields_per_thread> [yield|handoff|fp]" << endl;
+    cerr << "Example: ./switch-performance 99 100000 handoff" << endl;
+    exit(1);
+  }
+
+  thread_count = atoi(argv[1]);
+  yields_per_thread = atoi(argv[2]);
+  string mode = (argc == 4) ? argv[3] : "yield";
+  bool use_handoff = (mode == "handoff");
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <num_threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  // Create every thread before any of them runs so the ring is complete
+  threads = new int[thread_count];
+  finished = new bool[thread_count]();
+  void **args = new void*[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    args[i] = (void*)(long)i;
+  }
+  void* (*thread_fn)(void*) = use_handoff ? handoff : (mode == "fp") ? fp_yielder : yielder;
+  if (uthread_create_many(thread_count, thread_fn, args, threads) != 0) {
+    cerr << "Error: uthread_create_many" << endl;
+    exit(1);
+  }
+  delete[] args;
+
+  // Every thread switches away yields_per_thread times
+  uthread_stats_t start_stats, end_stats;
+  uthread_get_stats(&start_stats);
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < thread_count; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+  auto end = chrono::steady_clock::now();
+  uthread_get_stats(&end_stats);
+
+  // The main thread never changed its rounding mode, and must not pick up
+  // the mode of the thread it was switched back from
+  assert(fegetround() == FE_TONEAREST);
+  unsigned long switches = end_stats.switches - start_stats.switches;
+
+  delete[] threads;
+  delete[] finished;
+
+  double secs = chrono::duration<double>(end - start).count();
+  cout << thread_count << " threads, " << switches << " switches in " << secs << " s" << endl;
+  cout << (switches / secs) << " switches/s, " << (secs * 1e9 / switches) << " ns/switch" << endl;
+
+  unsigned long handoffs = end_stats.handoffs - start_stats.handoffs;
+  if (handoffs > 0) {
+    cout << handoffs << " handoffs, average latency "
+         << ((end_stats.handoff_total_ns - start_stats.handoff_total_ns) / handoffs)
+         << " ns, max " << end_stats.handoff_max_ns << " ns" << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,241 @@
+#include "uthread.h"
+#include "Lock.h"
+#include "CondVar.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 10000
+
+// Timed waits on Lock and CondVar. Threads that time out have to come back no
+// earlier than their deadline, holding nothing they should not, and must be
+// gone from the queue they waited on: a later unlock() or signal() has to
+// reach the threads still waiting instead of the ones that gave up
+static Lock lock;
+static CondVar hoare_cv;
+static CondVar mesa_cv(MESA_SEMANTICS);
+static CondVar *cv = &hoare_cv;
+static bool condition = false;
+static int timed_out = 0;
+static int signalled = 0;
+static vector<long> wake_order;
+
+static chrono::milliseconds timeout_step;
+
+void fail(const char *message) {
+  cerr << "Error: " << message << endl;
+  exit(1);
+}
+
+static long elapsedMs(chrono::steady_clock::time_point start) {
+  return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Wait on cv for id + 1 steps, timing out unless condition is set first
+void* cvWaiter(void *arg) {
+  long id = (long)arg;
+  chrono::milliseconds timeout = timeout_step * (id + 1);
+  auto start = chrono::steady_clock::now();
+
+  lock.lock();
+  bool woken = true;
+  while (!condition && woken) {
+    woken = cv->wait_for(lock, timeout - chrono::milliseconds(elapsedMs(start)));
+  }
+  if (!woken) {
+    if (elapsedMs(start) < timeout.count()) {
+      fail("wait_for timed out early");
+    }
+    timed_out++;
+    wake_order.push_back(id);
+  } else {
+    signalled++;
+  }
+  lock.unlock();
+  return nullptr;
+}
+
+// Try to take the lock held by main for id + 1 steps
+void* lockWaiter(void *arg) {
+  long id = (long)arg;
+  chrono::milliseconds timeout = timeout_step * (id + 1);
+  auto start = chrono::steady_clock::now();
+
+  if (lock.try_lock_for(timeout)) {
+    signalled++;
+    lock.unlock();
+    return nullptr;
+  }
+  if (elapsedMs(start) < timeout.count()) {
+    fail("try_lock_for timed out early");
+  }
+  timed_out++;
+  wake_order.push_back(id);
+  return nullptr;
+}
+
+static void checkOrder(int count) {
+  if ((int)wake_order.size() != count) {
+    fail("wrong number of threads timed out");
+  }
+  for (int i = 0; i < count; i++) {
+    if (wake_order[i] != i) {
+      fail("threads did not time out in deadline order");
+    }
+  }
+}
+
+static vector<int> spawn(void *(*fn)(void *), long count) {
+  vector<int> tids;
+  for (long i = 0; i < count; i++) {
+    int tid = uthread_create(fn, (void*)i);
+    if (tid < 0) {
+      fail("uthread_create");
+    }
+    tids.push_back(tid);
+  }
+  return tids;
+}
+
+static void joinAll(const vector<int> &tids) {
+  for (int tid : tids) {
+    uthread_join(tid, nullptr);
+  }
+}
+
+static void reset() {
+  condition = false;
+  timed_out = 0;
+  signalled = 0;
+  wake_order.clear();
+}
+
+// Every waiter times out, one per step, then the condition variable still works
+static void testCondVarTimeouts(int threads) {
+  reset();
+  uthread_stats_t before, after;
+  uthread_get_stats(&before);
+  joinAll(spawn(cvWaiter, threads));
+  uthread_get_stats(&after);
+
+  checkOrder(threads);
+  if (signalled != 0) {
+    fail("wait_for returned true without a signal");
+  }
+
+  // Each thread switched in to start waiting, once to time out and once more
+  // to finish after taking the lock. A polling wait would switch all the time
+  if (after.switches - before.switches > (unsigned long)(6 * threads + 10)) {
+    fail("timed waits switched threads while nothing happened");
+  }
+}
+
+// Half the waiters are signalled before their deadline, the rest time out
+static void testCondVarSignal(int threads) {
+  reset();
+  vector<int> tids = spawn(cvWaiter, threads);
+
+  // Let the first half time out, then wake the rest
+  uthread_usleep(chrono::duration_cast<chrono::microseconds>(timeout_step).count() * threads / 2 +
+                 chrono::duration_cast<chrono::microseconds>(timeout_step).count() / 2);
+  lock.lock();
+  condition = true;
+  for (int i = threads / 2; i < threads; i++) {
+    cv->signal();
+  }
+  lock.unlock();
+  joinAll(tids);
+
+  checkOrder(threads / 2);
+  if (signalled != threads - threads / 2) {
+    fail("signalled waiters were not woken up");
+  }
+
+  // The timers of the signalled waiters must be gone with them
+  auto start = chrono::steady_clock::now();
+  uthread_usleep(chrono::duration_cast<chrono::microseconds>(timeout_step).count() * threads);
+  if (elapsedMs(start) < timeout_step.count() * threads) {
+    fail("a stale timer woke up a sleeping thread");
+  }
+}
+
+// wait_until with a deadline in the past returns right away, with the lock
+static void testWaitUntil() {
+  lock.lock();
+  auto deadline = chrono::steady_clock::now() + timeout_step;
+  if (cv->wait_until(lock, deadline)) {
+    fail("wait_until returned true without a signal");
+  }
+  if (chrono::steady_clock::now() < deadline) {
+    fail("wait_until timed out early");
+  }
+  if (cv->wait_until(lock, deadline)) {
+    fail("wait_until with a past deadline returned true");
+  }
+  lock.unlock();
+}
+
+// Every lock waiter gives up while main holds the lock, then the lock is free
+static void testLockTimeouts(int threads) {
+  reset();
+  lock.lock();
+  joinAll(spawn(lockWaiter, threads));
+  checkOrder(threads);
+  lock.unlock();
+
+  // Nobody may be left in the lock's queue to hand the lock to
+  if (!lock.try_lock_for(chrono::nanoseconds(0))) {
+    fail("lock was not free after every waiter timed out");
+  }
+  lock.unlock();
+
+  // Half give up, the rest get the lock when main releases it
+  reset();
+  lock.lock();
+  vector<int> tids = spawn(lockWaiter, threads);
+  uthread_usleep(chrono::duration_cast<chrono::microseconds>(timeout_step).count() * threads / 2 +
+                 chrono::duration_cast<chrono::microseconds>(timeout_step).count() / 2);
+  lock.unlock();
+  joinAll(tids);
+  checkOrder(threads / 2);
+  if (signalled != threads - threads / 2) {
+    fail("waiters did not get the lock after it was released");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    cerr << "Usage: ./timed-testcase <threads> <step msecs> [hoare|mesa]" << endl;
+    cerr << "Example: ./timed-testcase 10 5 mesa" << endl;
+    exit(1);
+  }
+
+  int threads = atoi(argv[1]);
+  timeout_step = chrono::milliseconds(atoi(argv[2]));
+  if (threads < 2 || threads > 99 || timeout_step.count() < 1) {
+    cerr << "Error: <threads> must be between 2 and 99 and <step msecs> positive" << endl;
+    exit(1);
+  }
+  if (argc == 4 && strcmp(argv[3], "mesa") == 0) {
+    cv = &mesa_cv;
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  testCondVarTimeouts(threads);
+  testCondVarSignal(threads);
+  testWaitUntil();
+  testLockTimeouts(threads);
+
+  cout << "Timed waits passed with " << threads << " threads" << endl;
+  return 0;
+}
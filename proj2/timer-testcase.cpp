@@ -0,0 +1,103 @@
+#include "uthread.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+
+static volatile bool stop = false;
+
+// Burn CPU in user mode
+void* user_spinner(void *arg) {
+  volatile unsigned long count = 0;
+  while (!stop) {
+    count++;
+  }
+  return nullptr;
+}
+
+// Burn CPU in the kernel, which ITIMER_VIRTUAL does not count
+void* syscall_spinner(void *arg) {
+  while (!stop) {
+    syscall(SYS_getppid);
+  }
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cerr << "Usage: ./timer-testcase <virtual|monotonic|thread_cpu> <milliseconds>" << endl;
+    cerr << "Example: ./timer-testcase monotonic 1000" << endl;
+    exit(1);
+  }
+
+  TimerSource source;
+  if (strcmp(argv[1], "virtual") == 0) {
+    source = TIMER_VIRTUAL;
+  }
+  else if (strcmp(argv[1], "monotonic") == 0) {
+    source = TIMER_MONOTONIC;
+  }
+  else if (strcmp(argv[1], "thread_cpu") == 0) {
+    source = TIMER_THREAD_CPU;
+  }
+  else {
+    cerr << "Error: unknown timer source " << argv[1] << endl;
+    exit(1);
+  }
+  int milliseconds = atoi(argv[2]);
+
+  // Must come before uthread_init
+  if (uthread_set_timer_source(source) != 0) {
+    cerr << "Error: uthread_set_timer_source" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  int user_tid = uthread_create(user_spinner, nullptr);
+  int syscall_tid = uthread_create(syscall_spinner, nullptr);
+  if (user_tid < 0 || syscall_tid < 0) {
+    cerr << "Error: uthread_create" << endl;
+    exit(1);
+  }
+
+  // Block the whole process for a while first. Only a wall-clock timer
+  // notices the time passing
+  usleep(milliseconds * 1000 / 4);
+
+  // The main thread watches the wall clock and otherwise only yields
+  auto start = chrono::steady_clock::now();
+  int start_user = uthread_get_quantums(user_tid);
+  int start_syscall = uthread_get_quantums(syscall_tid);
+  while (chrono::steady_clock::now() - start < chrono::milliseconds(milliseconds)) {
+    uthread_yield();
+  }
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  int user_quantums = uthread_get_quantums(user_tid) - start_user;
+  int syscall_quantums = uthread_get_quantums(syscall_tid) - start_syscall;
+  stop = true;
+
+  uthread_join(user_tid, nullptr);
+  uthread_join(syscall_tid, nullptr);
+
+  // The spinners only give up the CPU when preempted, and the main thread
+  // yields right away, so the spinners' quanta fill the wall-clock time
+  int quantums = user_quantums + syscall_quantums;
+  cout << argv[1] << ": " << quantums << " quanta in " << secs << " s, "
+       << (secs * 1e6 / quantums) << " usecs each (quantum " << UTHREAD_TIME_QUANTUM << " usecs)" << endl;
+  cout << "User spinner quanta: " << user_quantums
+       << ", syscall spinner quanta: " << syscall_quantums << endl;
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "uthread.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+#define UTHREAD_TIME_QUANTUM 1000
+#define NUM_KEYS 12  // More keys than the TCB stores inline
+#define ITERATIONS 100000
+
+static int keys[NUM_KEYS];
+static int destructor_calls = 0;
+
+// Per-thread value stored under every key
+typedef struct thread_value {
+  int tid;
+  int key_index;
+} thread_value_t;
+
+void free_value(void *value) {
+  destructor_calls++;
+  delete (thread_value_t*)value;
+}
+
+void* worker(void *arg) {
+  int my_tid = uthread_self();
+
+  for (int k = 0; k < NUM_KEYS; k++) {
+    assert(uthread_getspecific(keys[k]) == nullptr);
+    thread_value_t *value = new thread_value_t;
+    value->tid = my_tid;
+    value->key_index = k;
+    uthread_setspecific(keys[k], value);
+  }
+
+  // Other threads run in between, each must keep seeing its own values
+  for (int i = 0; i < ITERATIONS; i++) {
+    int k = i % NUM_KEYS;
+    thread_value_t *value = (thread_value_t*)uthread_getspecific(keys[k]);
+    assert(value->tid == my_tid);
+    assert(value->key_index == k);
+    if (i % 1000 == 0) {
+      uthread_yield();
+    }
+  }
+
+  // Values are freed by the key destructors when the thread exits
+  return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    cerr << "Usage: ./tls-testcase <threads>" << endl;
+    cerr << "Example: ./tls-testcase 20" << endl;
+    exit(1);
+  }
+
+  int thread_count = atoi(argv[1]);
+
+  if (thread_count < 1 || thread_count > 99) {
+    cerr << "Error: <threads> must be between 1 and 99" << endl;
+    exit(1);
+  }
+
+  // Init user thread library
+  int ret = uthread_init(UTHREAD_TIME_QUANTUM);
+  if (ret != 0) {
+    cerr << "Error: uthread_init" << endl;
+    exit(1);
+  }
+
+  for (int k = 0; k < NUM_KEYS; k++) {
+    if (uthread_key_create(&keys[k], free_value) != 0) {
+      cerr << "Error: uthread_key_create" << endl;
+      exit(1);
+    }
+  }
+
+  int *threads = new int[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = uthread_create(worker, nullptr);
+    if (threads[i] < 0) {
+      cerr << "Error: uthread_create" << endl;
+    }
+  }
+
+  for (int i = 0; i < thread_count; i++) {
+    uthread_join(threads[i], nullptr);
+  }
+
+  delete[] threads;
+
+  assert(destructor_calls == thread_count * NUM_KEYS);
+  cout << "Destructors called: " << destructor_calls << endl;
+
+  // Deleted keys are reused and start out empty
+  int key;
+  uthread_setspecific(keys[0], &key);
+  uthread_key_delete(keys[0]);
+  uthread_key_create(&key, nullptr);
+  assert(key == keys[0]);
+  assert(uthread_getspecific(key) == nullptr);
+
+  return 0;
+}
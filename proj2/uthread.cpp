@@ -1,12 +1,22 @@
 #include "uthread.h"
 #include "uthread_private.h"
 #include "TCB.h"
+#include "TCBQueue.h"
+#include "Allocator.h"
+#include "LockProfile.h"
 #include <vector>
 #include <queue>
 #include <stdlib.h>
 #include <map>
 #include <algorithm>
 #include <cassert>
+#include <time.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 using namespace std;
 
@@ -23,6 +33,20 @@ using namespace std;
 #define WRONG_INPUT 3
 #define SIGNAL_ACTION_ERROR 4
 #define TOO_MANY_THREADS 5
+#define SCHEDULE_LOG_ERROR 6
+#define KEY_DESTRUCTOR_ITERATIONS 4
+#define SCHEDULE_LOG_MAGIC 0x48435355 // "USCH"
+#define SCHEDULE_LOG_VERSION 1
+#define GROUP_PERIOD_NS (GROUP_PERIOD_USECS * 1000UL)
+#define NANO_TO_MICRO 1000
+
+// Older glibc headers lack the name for the SIGEV_THREAD_ID target
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define STACK_BUCKET_SIZE 1024 // Bytes per stack usage histogram bucket
+#define STACK_BUCKETS (STACK_SIZE / STACK_BUCKET_SIZE)
 
 typedef struct join_queue_entry {
   TCB *tcb;
@@ -34,22 +58,99 @@ typedef struct finished_queue_entry {
   void *result;
 } finished_queue_entry_t;
 
-static queue<TCB*> redReady;
-static queue<TCB*> orangeReady;
-static queue<TCB*> greenReady;
+typedef struct fd_wait_entry {
+  TCB *tcb;
+  int fd;
+  short events;
+} fd_wait_entry_t;
+
+// A thread parked on a timer. Lives on the parked thread's stack
+typedef struct sleep_entry {
+  TCB *tcb;
+  bool (*cancel)(TCB *tcb, void *arg); // Takes a timed wait off its wait queue, NULL for a plain sleep
+  void *arg;
+  bool armed;              // Still in _sleeping
+  bool timed_out;          // Woken up by the deadline
+} sleep_entry_t;
+
+typedef struct budget_group {
+  unsigned long budget_ns; // Runtime allowed per period
+  unsigned long used_ns;   // Runtime charged in period
+  unsigned long period;    // Period used_ns was charged in
+  bool in_use;
+  TCBQueue throttled;      // Ready threads held back until the next period
+} budget_group_t;
+
+enum schedule_mode {SCHEDULE_NORMAL, SCHEDULE_RECORD, SCHEDULE_REPLAY};
+enum schedule_event {EVENT_SWITCH, EVENT_PREEMPT};
+
+typedef struct schedule_log_header {
+  uint32_t magic;
+  uint32_t version;
+} schedule_log_header_t;
+
+// One scheduling decision in a record/replay log
+typedef struct schedule_record {
+  uint32_t checkpoints; // Library calls the previous thread made in its turn
+  uint16_t tid;         // Thread switched to
+  uint8_t event;        // EVENT_SWITCH, or EVENT_PREEMPT for a timer preemption
+  uint8_t reserved;
+} schedule_record_t;
+
+// Library containers allocate with uthread_malloc, which is safe to call with
+// interrupts enabled
+typedef map<int, TCB*, less<int>, UthreadAllocator<pair<const int, TCB*> > > thread_map_t;
+typedef multimap<unsigned long, sleep_entry_t*, less<unsigned long>,
+                 UthreadAllocator<pair<const unsigned long, sleep_entry_t*> > > sleep_map_t;
+typedef vector<TCB*, UthreadAllocator<TCB*> > tcb_vector_t;
+typedef vector<join_queue_entry_t, UthreadAllocator<join_queue_entry_t> > join_queue_t;
+typedef vector<finished_queue_entry_t, UthreadAllocator<finished_queue_entry_t> > finished_queue_t;
+
+static TCBQueue redReady;
+static TCBQueue orangeReady;
+static TCBQueue greenReady;
 TCB* running; // The "Running" thread.
-static vector<TCB*> blocked; // The "Blocked" vector, which represents a queue of threads.
-static vector<join_queue_entry_t> join_queue;
-static vector<finished_queue_entry_t> finished_queue;
-static map<int, TCB*> _threads; // All threads together
+static tcb_vector_t blocked; // The "Blocked" vector, which represents a queue of threads.
+static join_queue_t join_queue;
+static finished_queue_t finished_queue;
+static thread_map_t _threads; // All threads together
 static int _quantum_counter = 0;
+static vector<void (*)(void*), UthreadAllocator<void (*)(void*)> > _key_destructors; // Destructor for each TLS key
+static vector<bool, UthreadAllocator<bool> > _key_in_use; // Which TLS keys are currently allocated
+static uthread_stats_t _stats; // Scheduler statistics
+static unsigned long _handoff_start_ns = 0; // When the pending uthread_yield_to started
+static sleep_map_t _sleeping; // Parked threads by wake-up deadline
+static vector<fd_wait_entry_t, UthreadAllocator<fd_wait_entry_t> > _fd_waiting; // Threads parked until an fd is ready
+static vector<struct pollfd, UthreadAllocator<struct pollfd> > _pollfds; // Scratch space for polling _fd_waiting
+static bool _poll_fds = false; // Set by the timer tick to poll _fd_waiting
+static schedule_mode _schedule_mode = SCHEDULE_NORMAL;
+bool schedule_tracing = false; // Set while _schedule_mode is not SCHEDULE_NORMAL
+static FILE* _schedule_file = NULL; // Log being recorded
+static vector<schedule_record_t, UthreadAllocator<schedule_record_t> > _replay_log; // Log being replayed
+static size_t _replay_pos = 0; // Next decision to replay
+static uint32_t _checkpoints = 0; // Library calls by the running thread in its turn
+static bool _preempting = false; // Set while the running thread is being preempted
+static budget_group_t _groups[MAX_GROUP_NUM];
+static vector<int, UthreadAllocator<int> > _free_groups; // Deleted group IDs to hand out again
+static int _group_count = 0; // Group IDs handed out so far, below MAX_GROUP_NUM
+static int _grouped_threads = 0; // Threads in a group, no accounting when zero
+static bool _throttling = false; // Set while some group may have throttled threads
+static unsigned long _throttled_period = 0; // Period the last thread was throttled in
+static unsigned long _run_start_ns = 0; // When the running thread was last charged
+static bool _stack_profiling = false;
+static unsigned long _stack_histogram[STACK_BUCKETS]; // Threads by stack high-water mark
+static size_t _stack_max_usage = 0; // Deepest stack of any thread
+static bool _live_stacks_sampled = false; // Set once live threads are in the histogram
 struct itimerval _timer;
+static TimerSource _timer_source = TIMER_VIRTUAL; // Clock driving preemption
+static timer_t _posix_timer; // Preemption timer for the non-virtual sources
 struct sigaction _sigAction;
 int* sig;
 
 
 static int removeFromReady(int tid);
 static TCB* popReady();
+static void traceSwitch(TCB* next);
 
 /**
  * function responsable for printing each kind of error
@@ -88,6 +189,11 @@ void printError(int type, string pre)
 		cerr << pre << "too many threads" << endl;
 		break;
 	}
+	case SCHEDULE_LOG_ERROR:
+	{
+		cerr << pre << "unable to use the schedule log" << endl;
+		break;
+	}
 	default:
 		break;
 	}
@@ -101,7 +207,7 @@ void printError(int type, string pre)
 int getNextId()
 {
 	int idToReturn = 0;
-	for (map<int, TCB*>::iterator iter = _threads.begin(); iter != _threads.end();
+	for (thread_map_t::iterator iter = _threads.begin(); iter != _threads.end();
 			idToReturn++, iter++)
 	{
 		if (iter->first != idToReturn)
@@ -138,19 +244,83 @@ void addToReady(TCB* th)
 	}
 }
 
+/**
+ * move every thread in the queue to the ready queues, splicing the whole
+ * queue over in one step when the threads share a priority
+ */
+void addAllToReady(TCBQueue& queue)
+{
+	bool same_priority = true;
+	Priority priority = queue.empty() ? MIN_PRIORITY : queue.front()->getPriority();
+	for (TCB* th = queue.front(); th != NULL; th = queue.next(th))
+	{
+		th->setState(READY);
+		same_priority = same_priority && th->getPriority() == priority;
+	}
+
+	if (!same_priority)
+	{
+		while (!queue.empty())
+		{
+			TCB* th = queue.front();
+			queue.pop();
+			addToReady(th);
+		}
+		return;
+	}
+
+	switch (priority)
+	{
+	case RED:
+		redReady.splice(queue);
+		break;
+	case ORANGE:
+		orangeReady.splice(queue);
+		break;
+	case GREEN:
+		greenReady.splice(queue);
+		break;
+	default:
+		break;
+	}
+}
+
 
 /**
- * set time and check if set is done correctly
+ * arm the preemption timer and check if set is done correctly
  */
-static void setTime()
+static void armTimer(const struct itimerval& value)
 {
-	if (setitimer(ITIMER_VIRTUAL, &_timer, NULL) == FAIL)
+	int ret;
+	if (_timer_source == TIMER_VIRTUAL)
+	{
+		ret = setitimer(ITIMER_VIRTUAL, &value, NULL);
+	}
+	else
+	{
+		struct itimerspec spec;
+		spec.it_value.tv_sec = value.it_value.tv_sec;
+		spec.it_value.tv_nsec = value.it_value.tv_usec * NANO_TO_MICRO;
+		spec.it_interval.tv_sec = value.it_interval.tv_sec;
+		spec.it_interval.tv_nsec = value.it_interval.tv_usec * NANO_TO_MICRO;
+		ret = timer_settime(_posix_timer, 0, &spec, NULL);
+	}
+
+	if (ret == FAIL)
 	{
 		printError(SET_TIME_ERROR, SYS_ERROR);
 		exit(1);
 	}
 }
 
+/**
+ * set time and check if set is done correctly
+ */
+static void setTime()
+{
+	armTimer(_timer);
+}
+
 
 /*
  * returns and remove from Ready the first thread in the queue 
@@ -159,17 +329,17 @@ TCB* getReady()
 {
 	TCB* ret = nullptr;
 	
-	if (redReady.size() > 0)
+	if (!redReady.empty())
 	{
 		ret = redReady.front();
 		redReady.pop();
 	}
-	else if (orangeReady.size() > 0)
+	else if (!orangeReady.empty())
 	{
 		ret = orangeReady.front();
 		orangeReady.pop();
 	}
-	else if (greenReady.size() > 0)
+	else if (!greenReady.empty())
 	{
 		ret = greenReady.front();
 		greenReady.pop();
@@ -193,63 +363,22 @@ TCB* popReady()
 
 
 /*
- * removes the thread with the given tid from ready.
+ * removes the thread with the given tid from ready, or from its group's
+ * throttled queue.
+ * returns FAIL if the thread is not on a ready or throttled queue.
  */
 int removeFromReady(int tid)
 {
-	// Checking red queue
 	TCB* target = _threads[tid];
-	if (target->getPriority() == MAX_PRIORITY)
+	if ((target->getState() != READY && target->getState() != THROTTLED) ||
+	    !TCBQueue::isQueued(target))
 	{
-		std::queue<TCB*> newRedReady;
-		while (!redReady.empty())
-		{
-			TCB* entry = redReady.front();
-			if (entry != target)
-			{
-				newRedReady.push(entry);
-			}
-			redReady.pop();
-		}
-		redReady = newRedReady;
-		return SUCCESS;
-	}
-
-	// Checking orange queue
-	if (target->getPriority() == DEFAULT_PRIORITY)
-	{
-		std::queue<TCB*> newOrangeReady;
-		while (!orangeReady.empty())
-		{
-			TCB* entry = orangeReady.front();
-			if (entry != target)
-			{
-				newOrangeReady.push(entry);
-			}
-			orangeReady.pop();
-		}
-		orangeReady = newOrangeReady;
-		return SUCCESS;
+		return FAIL;
 	}
 
-	// Checking green queue
-	if (target->getPriority() == MIN_PRIORITY)
-	{
-		std::queue<TCB*> newGreenReady;
-		while (!greenReady.empty())
-		{
-			TCB* entry = greenReady.front();
-			if (entry != target)
-			{
-				newGreenReady.push(entry);
-			}
-			greenReady.pop();
-		}
-		greenReady = newGreenReady;
-		return SUCCESS;
-	}
-	
-	return FAIL;
+	// Queues are intrusive, so the thread unlinks itself from its queue
+	TCBQueue::remove(target);
+	return SUCCESS;
 }
 
 
@@ -258,7 +387,7 @@ int removeFromReady(int tid)
  */
 void removeFromBlock(int tid)
 {
-	for (vector<TCB*>::iterator iter = blocked.begin(); iter != blocked.end(); ++iter)
+	for (tcb_vector_t::iterator iter = blocked.begin(); iter != blocked.end(); ++iter)
 	{
 		if (*iter == _threads.at(tid))
 		{
@@ -275,7 +404,7 @@ void removeFromBlock(int tid)
  */
 bool removeFromFinished(int tid, void **retval)
 {
-	for (vector<finished_queue_entry_t>::iterator iter = finished_queue.begin(); iter != finished_queue.end(); ++iter)
+	for (finished_queue_t::iterator iter = finished_queue.begin(); iter != finished_queue.end(); ++iter)
 	{
 		if (iter->tcb->getId() == tid)
 		{
@@ -306,7 +435,7 @@ bool removeFromFinished(int tid, void **retval)
  */
 void moveFromJoinToReady(int tid)
 {
-	for (vector<join_queue_entry_t>::iterator iter = join_queue.begin(); iter != join_queue.end(); /* Nothing to do */)
+	for (join_queue_t::iterator iter = join_queue.begin(); iter != join_queue.end(); /* Nothing to do */)
         {
                 // Check if this thread is waiting to join on this TID
                 if (tid == iter->waiting_for_tid)
@@ -324,149 +453,878 @@ void moveFromJoinToReady(int tid)
         }
 }
 
-// Switch to the thread provided
-void switchToThread(TCB *next)
+/*
+ * returns the current CLOCK_MONOTONIC time in nanoseconds
+ */
+unsigned long nowNs()
 {
-        bool already_switched_contexts = false;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
 
-        // Save the running thread context
-        getcontext(running->getContext());
+/*
+ * Refills the group's budget for every period that started since it was last
+ * charged. Runtime past the budget (the timer only fires on kernel ticks) is
+ * carried over, so the long-run share still matches the budget
+ */
+static void refillGroup(budget_group_t& group, unsigned long now)
+{
+	unsigned long period = now / GROUP_PERIOD_NS;
+	if (group.period != period)
+	{
+		unsigned long refill = (period - group.period) * group.budget_ns;
+		group.used_ns = (group.used_ns > refill) ? (group.used_ns - refill) : 0;
+		group.period = period;
+	}
+}
 
-        // If this is the first return from saveContext then fall through,
-        // otherwise this is the second return so break out
-        if (already_switched_contexts)
-        {
-		return;
-        }
+/*
+ * Charges the running thread's group for the time since the last charge
+ */
+static void chargeRunning(unsigned long now)
+{
+	int gid = running->getGroup();
+	if (gid != NO_GROUP)
+	{
+		refillGroup(_groups[gid], now);
+		_groups[gid].used_ns += now - _run_start_ns;
+	}
+	_run_start_ns = now;
+}
 
-        // Next return from saveContext break out
-        already_switched_contexts = true;
+// Return the budget group gid has left in the current period
+static unsigned long budgetLeft(int gid, unsigned long now)
+{
+	budget_group_t& group = _groups[gid];
+	refillGroup(group, now);
+	return (group.used_ns < group.budget_ns) ? (group.budget_ns - group.used_ns) : 0;
+}
 
-        // Pick a new thread to run and restart the quantum
-        running = next;
-        running->setState(RUNNING);
-        running->increaseQuantum();
-        _quantum_counter++;
-        setTime();
+/*
+ * Arms the timer for a new quantum of the running thread, cut short if its
+ * group has less budget left than that
+ */
+static void startQuantum()
+{
+	int gid = running->getGroup();
+	if (gid != NO_GROUP)
+	{
+		unsigned long left_usecs = budgetLeft(gid, _run_start_ns) / 1000;
+		unsigned long quantum_usecs = _timer.it_interval.tv_sec * MICRO_TO_SECOND + _timer.it_interval.tv_usec;
+		if (left_usecs < quantum_usecs)
+		{
+			struct itimerval slice = _timer;
+			slice.it_value.tv_sec = 0;
+			slice.it_value.tv_usec = (left_usecs > 0) ? left_usecs : 1;
+			armTimer(slice);
+			return;
+		}
+	}
+	setTime();
+}
+
+/*
+ * Moves th to its group's throttled queue if the group has spent its budget
+ * Returns true if th was throttled
+ */
+static bool throttle(TCB* th, unsigned long now)
+{
+	int gid = th->getGroup();
+	if (gid == NO_GROUP || budgetLeft(gid, now) > 0)
+	{
+		return false;
+	}
 
-        // Switch to the new thread
-        setcontext(running->getContext());
+	th->setState(THROTTLED);
+	_groups[gid].throttled.push(th);
+	_throttling = true;
+	_throttled_period = now / GROUP_PERIOD_NS;
+	_stats.throttles++;
+	return true;
 }
 
-// Switch to the next thread on the ready queue
-void switchThreads()
+// Moves every throttled thread of the group back to the ready queue
+static void releaseThrottled(budget_group_t& group)
 {
-	TCB *next = popReady();
-	assert(next);
-	switchToThread(next);
+	while (!group.throttled.empty())
+	{
+		TCB* th = group.throttled.front();
+		group.throttled.pop();
+		th->setState(READY);
+		addToReady(th);
+	}
 }
 
-static bool interrupts_enabled = true;
-void disableInterrupts()
+// Return when the next budget period starts
+static unsigned long nextPeriodNs(unsigned long now)
 {
-    if (interrupts_enabled)
-    {
-        sigprocmask(SIG_BLOCK,&_sigAction.sa_mask, NULL);
-        interrupts_enabled = false;
-    }
+	return (now / GROUP_PERIOD_NS + 1) * GROUP_PERIOD_NS;
 }
 
-void enableInterrupts()
+/*
+ * Charges a pending uthread_yield_to handoff to the scheduler stats. Called by
+ * the target thread once it is running
+ */
+static void finishHandoff()
 {
-    if (!interrupts_enabled)
-    {
-        interrupts_enabled = true;
-        sigprocmask(SIG_UNBLOCK,&_sigAction.sa_mask, NULL);
-    }
+	if (_handoff_start_ns == 0)
+	{
+		return;
+	}
+
+	unsigned long latency = nowNs() - _handoff_start_ns;
+	_handoff_start_ns = 0;
+	_stats.handoffs++;
+	_stats.handoff_total_ns += latency;
+	if (latency > _stats.handoff_max_ns)
+	{
+		_stats.handoff_max_ns = latency;
+	}
 }
 
-/**
- * switch between running thread and the this thread
+// Switch to the thread provided
+void switchToThread(TCB *next, bool restart_quantum)
+{
+        TCB* prev = running;
+
+        // Pick a new thread to run and restart the quantum unless the
+        // previous thread donated what is left of it
+        traceSwitch(next);
+        if (_grouped_threads > 0)
+        {
+                chargeRunning(nowNs());
+        }
+        running = next;
+        running->setState(RUNNING);
+        _stats.switches++;
+        if (restart_quantum)
+        {
+                running->increaseQuantum();
+                _quantum_counter++;
+                if (_grouped_threads > 0)
+                {
+                        startQuantum();
+                }
+                else
+                {
+                        setTime();
+                }
+        }
+
+        // Save the previous thread and switch to the new one. This returns
+        // once some thread switches back to prev
+        switchContext(prev->getContext(), next->getContext());
+        finishHandoff();
+}
+
+/*
+ * Moves parked threads whose deadline has passed or whose fd is ready to the
+ * ready queue. If block is true, waits until at least one of them can go
  */
-static void timeHandler(int signum)
+static void wakeParkedThreads(bool block)
 {
-        uthread_yield();
+	struct timespec timeout = {0, 0};
+	struct timespec *timeout_ptr = &timeout;
+	if (block)
+	{
+		// Sleep until the earliest deadline or the next budget period if
+		// threads are throttled, or indefinitely if only fd waiters are parked
+		timeout_ptr = NULL;
+		if (!_sleeping.empty() || _throttling)
+		{
+			unsigned long now = nowNs();
+			unsigned long deadline = _throttling ? nextPeriodNs(now) : _sleeping.begin()->first;
+			if (!_sleeping.empty() && _sleeping.begin()->first < deadline)
+			{
+				deadline = _sleeping.begin()->first;
+			}
+			unsigned long wait_ns = (deadline > now) ? (deadline - now) : 0;
+			timeout.tv_sec = wait_ns / 1000000000UL;
+			timeout.tv_nsec = wait_ns % 1000000000UL;
+			timeout_ptr = &timeout;
+		}
+	}
+
+	if (!_fd_waiting.empty() && (block || _poll_fds))
+	{
+		_poll_fds = false;
+		_pollfds.resize(_fd_waiting.size());
+		for (size_t i = 0; i < _fd_waiting.size(); i++)
+		{
+			_pollfds[i].fd = _fd_waiting[i].fd;
+			_pollfds[i].events = _fd_waiting[i].events;
+			_pollfds[i].revents = 0;
+		}
+
+		if (ppoll(_pollfds.data(), _pollfds.size(), timeout_ptr, NULL) > 0)
+		{
+			// Walk backwards so erasing keeps the indices lined up
+			for (size_t i = _pollfds.size(); i-- > 0; )
+			{
+				if (_pollfds[i].revents != 0)
+				{
+					_fd_waiting[i].tcb->setState(READY);
+					addToReady(_fd_waiting[i].tcb);
+					_fd_waiting.erase(_fd_waiting.begin() + i);
+				}
+			}
+		}
+	}
+	else if (block)
+	{
+		// NOTE: Not nanosleep, which may be wrapped to call back in here
+		assert(timeout_ptr != NULL);
+		clock_nanosleep(CLOCK_MONOTONIC, 0, timeout_ptr, NULL);
+	}
+
+	unsigned long now = nowNs();
+	while (!_sleeping.empty() && _sleeping.begin()->first <= now)
+	{
+		sleep_entry_t* entry = _sleeping.begin()->second;
+		_sleeping.erase(_sleeping.begin());
+		entry->armed = false;
+
+		// A timed wait may have been woken up already, or moved on to wait
+		// for something its timeout does not cover
+		if (entry->tcb->getState() == BLOCK &&
+		    (entry->cancel == NULL || entry->cancel(entry->tcb, entry->arg)))
+		{
+			entry->timed_out = true;
+			entry->tcb->setState(READY);
+			addToReady(entry->tcb);
+		}
+	}
 }
 
 /*=================================================================================================
- * ======================================Library Functions=========================================
+ * ====================================Schedule Record/Replay======================================
  * ================================================================================================
+ *
+ * Every switch is logged as the thread switched to, whether the timer forced
+ * it, and how many library calls (interrupt-disabling entries) the previous
+ * thread made since it was switched to. Given the same program and input, a
+ * thread's sequence of library calls only depends on the schedule, so a replay
+ * can put each timer preemption back at the same library call and pick the
+ * same thread at every switch
  */
 
-/* Stub function */
-void stub(void *(*start_routine)(void *), void *arg)
+static void stopReplay(const char* reason)
 {
-        enableInterrupts();
-        void *result = start_routine(arg);
-        uthread_exit(result);
+	cerr << "uthread: " << reason << ", schedule replay stopped at decision "
+	     << _replay_pos << " of " << _replay_log.size() << endl;
+	_schedule_mode = SCHEDULE_NORMAL;
+	schedule_tracing = false;
 }
 
-/* Initialize the thread library */
-int uthread_init(int quantum_usecs)
+// Return true if the next recorded decision is a preemption of the running
+// thread at its current library call count
+static bool replayPreemptDue()
 {
-	if (quantum_usecs <= 0)
+	return _replay_pos < _replay_log.size() &&
+	       _replay_log[_replay_pos].event == EVENT_PREEMPT &&
+	       _replay_log[_replay_pos].checkpoints == _checkpoints;
+}
+
+// Logs or checks the decision to switch to next. Called on every switch
+static void traceSwitch(TCB* next)
+{
+	schedule_record_t record =
 	{
-		printError(WRONG_INPUT ,THREAD_ERROR);
-		return FAIL;
+		.checkpoints = _checkpoints,
+		.tid = (uint16_t)next->getId(),
+		.event = (uint8_t)(_preempting ? EVENT_PREEMPT : EVENT_SWITCH),
+		.reserved = 0
+	};
+	_preempting = false;
+	_checkpoints = 0;
+
+	if (_schedule_mode == SCHEDULE_RECORD)
+	{
+		fwrite(&record, sizeof(record), 1, _schedule_file);
+	}
+	else if (_schedule_mode == SCHEDULE_REPLAY)
+	{
+		const schedule_record_t& expected = _replay_log[_replay_pos];
+		if (expected.tid != record.tid || expected.event != record.event ||
+		    expected.checkpoints != record.checkpoints)
+		{
+			stopReplay("run diverged from the log");
+		}
+		else if (++_replay_pos == _replay_log.size())
+		{
+			_schedule_mode = SCHEDULE_NORMAL;
+			schedule_tracing = false;
+		}
 	}
+}
 
-	//initialize sigaction
-	_sigAction.sa_handler = timeHandler;
-	if(sigemptyset (&_sigAction.sa_mask) == FAIL)
+// Return true if th is parked on a timer or an fd
+static bool isParked(TCB* th)
+{
+	for (sleep_map_t::iterator iter = _sleeping.begin(); iter != _sleeping.end(); ++iter)
 	{
-		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
-		exit(1);
+		if (iter->second->tcb == th)
+		{
+			return true;
+		}
 	}
-	if(sigaddset(&_sigAction.sa_mask, SIGVTALRM))
+	for (size_t i = 0; i < _fd_waiting.size(); i++)
 	{
-		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
-		exit(1);
+		if (_fd_waiting[i].tcb == th)
+		{
+			return true;
+		}
 	}
-	_sigAction.sa_flags = 0;
-	if(sigaction(SIGVTALRM,&_sigAction,NULL) == FAIL)
+	return false;
+}
+
+/*
+ * Removes the thread the log switches to next from the ready queue and returns
+ * it, waiting for it first if it is still parked. Returns NULL and stops the
+ * replay if it can't run
+ */
+static TCB* replayNext()
+{
+	thread_map_t::iterator iter = _threads.find(_replay_log[_replay_pos].tid);
+	if (iter == _threads.end())
 	{
-		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
-		exit(1);
+		stopReplay("logged thread does not exist");
+		return NULL;
 	}
 
-	//initialize timer
-	_timer.it_value.tv_sec = (int)(quantum_usecs/MICRO_TO_SECOND);
-	_timer.it_value.tv_usec = quantum_usecs % MICRO_TO_SECOND;
-	_timer.it_interval.tv_sec = (int)(quantum_usecs/MICRO_TO_SECOND);
-	_timer.it_interval.tv_usec = quantum_usecs % MICRO_TO_SECOND;
+	// Timer and fd wake-ups depend on wall-clock time, so the logged thread
+	// may not be awake yet in this run
+	TCB* target = iter->second;
+	while (target->getState() == BLOCK && isParked(target))
+	{
+		wakeParkedThreads(true);
+	}
 
-	//initialize main
-	TCB* mainTh = new TCB(0, NULL, NULL, READY);
-	_threads.insert(pair<int, TCB*>(0, mainTh));
-	running = mainTh;
-	mainTh->setState(RUNNING);
-	mainTh->increaseQuantum();
-	_quantum_counter++;
-	setTime();
-	return SUCCESS;
+	// A budget that ran out sooner than in the recorded run holds it back
+	if (target->getState() == THROTTLED)
+	{
+		stopReplay("logged thread is throttled");
+		return NULL;
+	}
+	if (target->getState() != READY || !TCBQueue::isQueued(target))
+	{
+		stopReplay("logged thread is not ready");
+		return NULL;
+	}
+	TCBQueue::remove(target);
+	return target;
 }
 
-/* Create a new thread whose entry point is f */
-//int uthread_create(void *(*start_routine)(void), void *arg)
-int uthread_create(void* (*start_routine)(void*), void* arg)
+static void closeScheduleLog()
 {
-	//can't add any more!!
-	if(_threads.size() == 100)
+	if (_schedule_file != NULL)
 	{
-		printError(TOO_MANY_THREADS, THREAD_ERROR);
-		return FAIL;
+		fclose(_schedule_file);
+		_schedule_file = NULL;
 	}
+}
 
-        disableInterrupts();
+/*
+ * Returns and removes the first ready thread whose group has budget left,
+ * moving threads of groups that have run out to their throttled queues.
+ * Throttled threads are released once a new period has started
+ */
+static TCB* popUnthrottled()
+{
+	unsigned long now = nowNs();
+	chargeRunning(now);
+
+	if (_throttling && now / GROUP_PERIOD_NS != _throttled_period)
+	{
+		// Every group has a fresh budget
+		for (int gid = 0; gid < _group_count; gid++)
+		{
+			releaseThrottled(_groups[gid]);
+		}
+		_throttling = false;
+	}
+
+	TCB* next = popReady();
+	while (next != NULL && throttle(next, now))
+	{
+		next = popReady();
+	}
+	return next;
+}
+
+// Switch to the next thread on the ready queue
+void switchThreads()
+{
+	if (!_sleeping.empty() || _poll_fds)
+	{
+		wakeParkedThreads(false);
+	}
+
+	if (_schedule_mode == SCHEDULE_REPLAY)
+	{
+		TCB *next = replayNext();
+		if (next != NULL)
+		{
+			switchToThread(next);
+			return;
+		}
+	}
+
+	TCB *next = (_grouped_threads > 0) ? popUnthrottled() : popReady();
+	while (next == NULL)
+	{
+		// Every thread is parked or throttled, wait for one of them to be
+		// woken up
+		assert(!_sleeping.empty() || !_fd_waiting.empty() || _throttling);
+		wakeParkedThreads(true);
+		next = (_grouped_threads > 0) ? popUnthrottled() : popReady();
+	}
+	switchToThread(next);
+}
+
+// Block the running thread until CLOCK_MONOTONIC reaches deadline_ns
+void sleepUntil(unsigned long deadline_ns)
+{
+	blockUntil(deadline_ns, NULL, NULL);
+}
+
+// Block the running thread until it is woken up or deadline_ns passes
+bool blockUntil(unsigned long deadline_ns, bool (*cancel)(TCB *tcb, void *arg), void *arg,
+                TCB *next)
+{
+	sleep_entry_t entry =
+	{
+		.tcb = running,
+		.cancel = cancel,
+		.arg = arg,
+		.armed = true,
+		.timed_out = false
+	};
+	sleep_map_t::iterator timer =
+		_sleeping.insert(pair<unsigned long, sleep_entry_t*>(deadline_ns, &entry));
+	running->setState(BLOCK);
+	if (next != NULL)
+	{
+		switchToThread(next);
+	}
+	else
+	{
+		switchThreads();
+	}
+
+	// Woken up before the deadline, disarm the timer through the iterator
+	// instead of searching for it
+	if (entry.armed)
+	{
+		_sleeping.erase(timer);
+	}
+	return !entry.timed_out;
+}
+
+// Block the running thread until poll() reports one of events on fd
+void waitForFd(int fd, short events)
+{
+	fd_wait_entry_t entry =
+	{
+		.tcb = running,
+		.fd = fd,
+		.events = events
+	};
+	_fd_waiting.push_back(entry);
+	running->setState(BLOCK);
+	switchThreads();
+}
+
+static bool interrupts_enabled = true;
+volatile int preempt_disable_count = 0;
+volatile bool preempt_pending = false;
+void disableInterrupts()
+{
+    if (interrupts_enabled)
+    {
+        // Preempt at the library call where the timer hit in the recorded run
+        if (_schedule_mode == SCHEDULE_REPLAY && !_preempting && replayPreemptDue())
+        {
+            _preempting = true;
+            uthread_yield();
+        }
+
+        sigprocmask(SIG_BLOCK,&_sigAction.sa_mask, NULL);
+        interrupts_enabled = false;
+
+        // Count the call once the timer can no longer preempt it, but not the
+        // preemption itself
+        if (!_preempting)
+        {
+            _checkpoints++;
+        }
+    }
+}
+
+void enableInterrupts()
+{
+    if (!interrupts_enabled)
+    {
+        interrupts_enabled = true;
+        sigprocmask(SIG_UNBLOCK,&_sigAction.sa_mask, NULL);
+    }
+}
+
+/*
+ * Calls the TLS key destructors for the running thread's non-null values.
+ * A destructor may store new values, so make a few passes until none are left
+ */
+static void runKeyDestructors()
+{
+	for (int pass = 0; pass < KEY_DESTRUCTOR_ITERATIONS; pass++)
+	{
+		bool called = false;
+		for (int key = 0; ; key++)
+		{
+			disableInterrupts();
+			if (key >= (int)_key_destructors.size())
+			{
+				enableInterrupts();
+				break;
+			}
+			void (*destructor)(void*) = _key_destructors[key];
+			void* value = running->getSpecific(key);
+			if (!_key_in_use[key] || destructor == NULL || value == NULL)
+			{
+				enableInterrupts();
+				continue;
+			}
+			running->setSpecific(key, NULL);
+			enableInterrupts();
+
+			destructor(value);
+			called = true;
+		}
+
+		if (!called)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * switch between running thread and the this thread
+ */
+static void preempt()
+{
+        // When replaying, only preempt where the recorded run was preempted
+        if (_schedule_mode == SCHEDULE_REPLAY && (_preempting || !replayPreemptDue()))
+        {
+                return;
+        }
+
+        _preempting = true;
+        uthread_yield();
+}
+
+static void timeHandler(int signum)
+{
+        // Check on threads parked on an fd once per quantum
+        _poll_fds = !_fd_waiting.empty();
+
+        // Hold the preemption off until the thread leaves preemptDisable
+        if (preempt_disable_count > 0)
+        {
+                preempt_pending = true;
+                return;
+        }
+
+        preempt();
+}
+
+// Run the preemption a timer tick left pending
+void runPendingPreemption()
+{
+        // A thread that disabled interrupts in between keeps running, the
+        // next preemptEnable with interrupts enabled picks this up
+        if (!interrupts_enabled)
+        {
+                return;
+        }
+
+        preempt_pending = false;
+        preempt();
+}
+
+/*
+ * Adds a thread's stack high-water mark to the stack usage histogram
+ */
+static void sampleStack(TCB* th)
+{
+	size_t usage = th->getStackUsage();
+	int bucket = usage / STACK_BUCKET_SIZE;
+	_stack_histogram[(bucket < STACK_BUCKETS) ? bucket : STACK_BUCKETS - 1]++;
+	if (usage > _stack_max_usage)
+	{
+		_stack_max_usage = usage;
+	}
+}
+
+/*
+ * Adds the threads that have not exited yet to the stack usage histogram
+ */
+static void sampleLiveStacks()
+{
+	if (_live_stacks_sampled)
+	{
+		return;
+	}
+	_live_stacks_sampled = true;
+
+	for (thread_map_t::iterator iter = _threads.begin(); iter != _threads.end(); ++iter)
+	{
+		bool finished = false;
+		for (size_t i = 0; i < finished_queue.size(); i++)
+		{
+			finished = finished || (finished_queue[i].tcb == iter->second);
+		}
+		if (iter->first != MAIN_THREAD && !finished)
+		{
+			sampleStack(iter->second);
+		}
+	}
+}
+
+/*
+ * Prints the stack usage histogram when the program exits
+ */
+static void reportStacks()
+{
+	sampleLiveStacks();
+
+	unsigned long threads = 0;
+	for (int i = 0; i < STACK_BUCKETS; i++)
+	{
+		threads += _stack_histogram[i];
+	}
+
+	cerr << "uthread stack usage: " << threads << " threads, deepest " << _stack_max_usage
+	     << " of " << STACK_SIZE << " bytes" << endl;
+	for (int i = 0; i < STACK_BUCKETS; i++)
+	{
+		if (_stack_histogram[i] > 0)
+		{
+			cerr << "  " << i * STACK_BUCKET_SIZE << "-" << (i + 1) * STACK_BUCKET_SIZE - 1
+			     << " bytes: " << _stack_histogram[i] << endl;
+		}
+	}
+}
+
+/*=================================================================================================
+ * ======================================Library Functions=========================================
+ * ================================================================================================
+ */
+
+/* Stub function */
+void stub(void *(*start_routine)(void *), void *arg)
+{
+        finishHandoff();
+        enableInterrupts();
+        void *result = start_routine(arg);
+        uthread_exit(result);
+}
+
+/* Initialize the thread library */
+int uthread_init(int quantum_usecs)
+{
+	if (quantum_usecs <= 0)
+	{
+		printError(WRONG_INPUT ,THREAD_ERROR);
+		return FAIL;
+	}
+
+	// Record or replay the schedule if asked to through the environment
+	const char* record_path = getenv("UTHREAD_RECORD");
+	if (record_path != NULL && uthread_record_schedule(record_path) == FAIL)
+	{
+		return FAIL;
+	}
+	const char* replay_path = getenv("UTHREAD_REPLAY");
+	if (replay_path != NULL && uthread_replay_schedule(replay_path) == FAIL)
+	{
+		return FAIL;
+	}
+	if (getenv("UTHREAD_STACK_PROFILE") != NULL && !_stack_profiling &&
+	    uthread_profile_stacks() == FAIL)
+	{
+		return FAIL;
+	}
+	if (getenv("UTHREAD_LOCK_PROFILE") != NULL && !lock_profiling)
+	{
+		uthread_profile_locks(1);
+		atexit(reportLockStats);
+	}
+	const char* timer_name = getenv("UTHREAD_TIMER");
+	if (timer_name != NULL)
+	{
+		TimerSource source;
+		if (strcmp(timer_name, "virtual") == 0)
+		{
+			source = TIMER_VIRTUAL;
+		}
+		else if (strcmp(timer_name, "monotonic") == 0)
+		{
+			source = TIMER_MONOTONIC;
+		}
+		else if (strcmp(timer_name, "thread_cpu") == 0)
+		{
+			source = TIMER_THREAD_CPU;
+		}
+		else
+		{
+			printError(WRONG_INPUT, THREAD_ERROR);
+			return FAIL;
+		}
+		uthread_set_timer_source(source);
+	}
+
+	//initialize sigaction
+	_sigAction.sa_handler = timeHandler;
+	if(sigemptyset (&_sigAction.sa_mask) == FAIL)
+	{
+		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
+		exit(1);
+	}
+	if(sigaddset(&_sigAction.sa_mask, SIGVTALRM))
+	{
+		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
+		exit(1);
+	}
+	// Wall-clock ticks also land while a thread is in a system call, which
+	// should carry on once the thread runs again
+	_sigAction.sa_flags = SA_RESTART;
+	if(sigaction(SIGVTALRM,&_sigAction,NULL) == FAIL)
+	{
+		printError(SIGNAL_ACTION_ERROR, SYS_ERROR);
+		exit(1);
+	}
+
+	// The POSIX timer signals this kernel thread only, with the same signal
+	// as ITIMER_VIRTUAL so disabling interrupts works the same way
+	if (_timer_source != TIMER_VIRTUAL)
+	{
+		struct sigevent event;
+		memset(&event, 0, sizeof(event));
+		event.sigev_notify = SIGEV_THREAD_ID;
+		event.sigev_signo = SIGVTALRM;
+		event.sigev_notify_thread_id = syscall(SYS_gettid);
+		clockid_t clock = (_timer_source == TIMER_MONOTONIC) ? CLOCK_MONOTONIC : CLOCK_THREAD_CPUTIME_ID;
+		if (timer_create(clock, &event, &_posix_timer) == FAIL)
+		{
+			printError(SET_TIME_ERROR, SYS_ERROR);
+			return FAIL;
+		}
+	}
+
+	//initialize timer
+	_timer.it_value.tv_sec = (int)(quantum_usecs/MICRO_TO_SECOND);
+	_timer.it_value.tv_usec = quantum_usecs % MICRO_TO_SECOND;
+	_timer.it_interval.tv_sec = (int)(quantum_usecs/MICRO_TO_SECOND);
+	_timer.it_interval.tv_usec = quantum_usecs % MICRO_TO_SECOND;
+
+	//initialize main
+	TCB* mainTh = new TCB(0, NULL, NULL, READY);
+	_threads.insert(pair<int, TCB*>(0, mainTh));
+	running = mainTh;
+	mainTh->setState(RUNNING);
+	mainTh->increaseQuantum();
+	_quantum_counter++;
+	setTime();
+	return SUCCESS;
+}
+
+/* Create a new thread whose entry point is f */
+//int uthread_create(void *(*start_routine)(void), void *arg)
+int uthread_create(void* (*start_routine)(void*), void* arg)
+{
+	return uthread_create_with_stack_arg(start_routine, 0, NULL, arg);
+}
+
+/* Create a new thread whose argument lives at the top of its own stack */
+int uthread_create_with_stack_arg(void* (*start_routine)(void*), size_t arg_size,
+                                  void (*init)(void* buffer, void* init_arg), void* init_arg)
+{
+	//can't add any more!!
+	if(_threads.size() >= MAX_THREAD_NUM)
+	{
+		printError(TOO_MANY_THREADS, THREAD_ERROR);
+		return FAIL;
+	}
+
+	if(start_routine == NULL || arg_size > STACK_SIZE / 2)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+        disableInterrupts();
 
 	int tid = getNextId();
-	TCB* th = new TCB(tid, start_routine, arg, READY);
+	TCB* th = new TCB(tid, start_routine, init_arg, READY, arg_size);
 	_threads.insert(pair<int, TCB*>(tid, th));
 
-	addToReady(th);
+        // Fill in the reserved buffer before the thread can be scheduled
+        if (arg_size > 0 && init != NULL)
+        {
+                init(th->getStackArg(), init_arg);
+        }
+
+	addToReady(th);
+
+	enableInterrupts();
+	return tid;
+}
+
+/* Create n threads whose entry point is start_routine */
+int uthread_create_many(int n, void* (*start_routine)(void*), void* args[], int tids[])
+{
+	if(n <= 0 || start_routine == NULL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+        disableInterrupts();
+
+	//can't add all of them!!
+	if(_threads.size() + n > MAX_THREAD_NUM)
+	{
+		enableInterrupts();
+		printError(TOO_MANY_THREADS, THREAD_ERROR);
+		return FAIL;
+	}
+
+        // Walk the thread map once, handing out the gaps in the id space. The
+        // iterator is the insert hint, so each insert is amortized O(1)
+	thread_map_t::iterator iter = _threads.begin();
+	int tid = 0;
+	for (int i = 0; i < n; i++, tid++)
+	{
+		while (iter != _threads.end() && iter->first == tid)
+		{
+			iter++;
+			tid++;
+		}
+
+		TCB* th = new TCB(tid, start_routine, args ? args[i] : NULL, READY);
+		_threads.emplace_hint(iter, tid, th);
+		addToReady(th);
+
+		if (tids)
+		{
+			tids[i] = tid;
+		}
+	}
 
 	enableInterrupts();
-	return tid;
+	return SUCCESS;
 }
 
 /* Join a thread */
@@ -528,11 +1386,19 @@ void uthread_exit(void *retval)
 {
 	int tid = running->getId();
 
+	runKeyDestructors();
+
 	//terminate main
 	if (tid == MAIN_THREAD)
 	{
+                // Measure the stacks that are about to be freed
+                if (_stack_profiling)
+                {
+                        sampleLiveStacks();
+                }
+
                 // Clean up the thread TCBs
-	        for (map<int, TCB*>::iterator iter = _threads.begin(); iter != _threads.end(); iter++)
+	        for (thread_map_t::iterator iter = _threads.begin(); iter != _threads.end(); iter++)
 	        {
                         delete iter->second;
 	        }
@@ -541,6 +1407,19 @@ void uthread_exit(void *retval)
 
 	disableInterrupts();
 
+        if (_stack_profiling)
+        {
+                sampleStack(running);
+        }
+
+        // Charge the thread's last run to its group and leave it
+        if (running->getGroup() != NO_GROUP)
+        {
+                chargeRunning(nowNs());
+                running->setGroup(NO_GROUP);
+                _grouped_threads--;
+        }
+
         // Move any threads joining on this thread to the ready queue
         moveFromJoinToReady(tid);
 
@@ -631,6 +1510,65 @@ int uthread_resume(int tid)
 	}
 }
 
+// Give the rest of the running thread's quantum to target
+bool yieldTo(TCB* target)
+{
+	// Only a thread sitting on a ready queue can be switched to, not one its
+	// group's budget holds back
+	if (target->getState() != READY || !TCBQueue::isQueued(target))
+	{
+		return false;
+	}
+
+	// Threads are only throttled when the scheduler picks them, so check the
+	// target's budget like popUnthrottled would
+	if (_grouped_threads > 0 && target->getGroup() != NO_GROUP)
+	{
+		unsigned long now = nowNs();
+		chargeRunning(now);
+		if (budgetLeft(target->getGroup(), now) == 0)
+		{
+			TCBQueue::remove(target);
+			throttle(target, now);
+			return false;
+		}
+	}
+
+	_handoff_start_ns = nowNs();
+	TCBQueue::remove(target);
+	running->setState(READY);
+	addToReady(running);
+
+	// The target runs out the rest of this thread's quantum
+	switchToThread(target, false);
+	return true;
+}
+
+/* Switch directly to a ready thread */
+int uthread_yield_to(int tid)
+{
+	disableInterrupts();
+
+	thread_map_t::iterator iter = _threads.find(tid);
+	if (iter == _threads.end())
+	{
+		enableInterrupts();
+		printError(NOT_FOUND_ID, THREAD_ERROR);
+		return FAIL;
+	}
+
+	TCB* target = iter->second;
+	if (target == running)
+	{
+		enableInterrupts();
+		return SUCCESS;
+	}
+
+	int ret = yieldTo(target) ? SUCCESS : FAIL;
+	enableInterrupts();
+	return ret;
+}
+
 /* Get the id of the calling thread */
 int uthread_self()
 {
@@ -671,19 +1609,25 @@ int uthread_increase_priority(int tid)
 		return FAIL;
 	}
 
-    switch ( _threads[ tid ]->getPriority( ) )
+    switch ( _threads[ tid ]->getBasePriority( ) )
     {
     case ORANGE:
     case GREEN:
-        _threads[ tid ]->increasePriority( );
-        return SUCCESS;
+        break;
     default:
         return FAIL;
     }
 
-    // Remove from current queue and place on the correct priority
-    removeFromReady( tid );
-    addToReady( _threads[ tid ] );
+    // Move to the queue for the new priority, a boosted lock holder may not
+    // change queues at all
+    disableInterrupts( );
+    TCB *th = _threads[ tid ];
+    Priority old_priority = th->getPriority( );
+    th->increasePriority( );
+    priorityChanged( th, old_priority );
+    enableInterrupts( );
+
+    return SUCCESS;
 }
 
 /* Decrease the thread's priority by one level */
@@ -695,19 +1639,25 @@ int uthread_decrease_priority(int tid)
 		return FAIL;
 	}
 
-    switch ( _threads[ tid ]->getPriority( ) )
+    switch ( _threads[ tid ]->getBasePriority( ) )
     {
     case RED:
     case ORANGE:
-        _threads[ tid ]->decreasePriority( );
-        return SUCCESS;
+        break;
     default:
         return FAIL;
     }
 
-    // Remove from current queue and place on the correct priority
-    removeFromReady( tid );
-    addToReady( _threads[ tid ] );
+    // Move to the queue for the new priority, a boosted lock holder may not
+    // change queues at all
+    disableInterrupts( );
+    TCB *th = _threads[ tid ];
+    Priority old_priority = th->getPriority( );
+    th->decreasePriority( );
+    priorityChanged( th, old_priority );
+    enableInterrupts( );
+
+    return SUCCESS;
 }
 
 /* Set the thread's priority level */
@@ -719,24 +1669,370 @@ int uthread_set_priority(int tid, Priority priority)
 		return FAIL;
 	}
 
-    if ( _threads[ tid ]->getPriority( ) == priority )
-    {
-        return SUCCESS;
-    }
+    disableInterrupts( );
+    TCB *th = _threads[ tid ];
+    Priority old_priority = th->getPriority( );
 
-    while ( _threads[ tid ]->getPriority( ) < priority )
+    while ( th->getBasePriority( ) < priority )
     {
-        _threads[ tid ]->increasePriority( );
+        th->increasePriority( );
     }
 
-    while ( _threads[ tid ]->getPriority( ) > priority )
+    while ( th->getBasePriority( ) > priority )
     {
-        _threads[ tid ]->decreasePriority( );
+        th->decreasePriority( );
     }
 
-    // Remove from current queue and place on the correct priority
-    removeFromReady( tid );
-    addToReady( _threads[ tid ] );
+    // Move to the queue for the new priority
+    priorityChanged( th, old_priority );
+    enableInterrupts( );
 
     return SUCCESS;
 }
+
+/* Create a thread-local storage key */
+int uthread_key_create(int *key, void (*destructor)(void*))
+{
+	if (key == NULL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	disableInterrupts();
+
+	// Reuse a deleted key if there is one
+	int newKey = find(_key_in_use.begin(), _key_in_use.end(), false) - _key_in_use.begin();
+	if (newKey == MAX_KEYS)
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+	if (newKey == (int)_key_in_use.size())
+	{
+		_key_in_use.push_back(true);
+		_key_destructors.push_back(destructor);
+	}
+	else
+	{
+		_key_in_use[newKey] = true;
+		_key_destructors[newKey] = destructor;
+	}
+
+	enableInterrupts();
+
+	*key = newKey;
+	return SUCCESS;
+}
+
+/* Delete a thread-local storage key */
+int uthread_key_delete(int key)
+{
+	disableInterrupts();
+
+	if (key < 0 || key >= (int)_key_in_use.size() || !_key_in_use[key])
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	// Clear the values so a later key reusing this slot starts out empty
+	for (thread_map_t::iterator iter = _threads.begin(); iter != _threads.end(); iter++)
+	{
+		iter->second->setSpecific(key, NULL);
+	}
+	_key_in_use[key] = false;
+	_key_destructors[key] = NULL;
+
+	enableInterrupts();
+	return SUCCESS;
+}
+
+/* Get the calling thread's value for a thread-local storage key */
+void* uthread_getspecific(int key)
+{
+	if (key < 0 || running == NULL)
+	{
+		return NULL;
+	}
+	return running->getSpecific(key);
+}
+
+/* Set the calling thread's value for a thread-local storage key */
+int uthread_setspecific(int key, const void* value)
+{
+	if (key < 0 || key >= (int)_key_in_use.size() || !_key_in_use[key] || running == NULL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	// Inline slots are a plain store. The overflow table may be allocated, so
+	// keep the scheduler out while it is updated
+	if (key < TLS_FAST_SLOTS)
+	{
+		running->setSpecific(key, (void*)value);
+	}
+	else
+	{
+		disableInterrupts();
+		running->setSpecific(key, (void*)value);
+		enableInterrupts();
+	}
+
+	return SUCCESS;
+}
+
+/* Get the scheduler statistics */
+int uthread_get_stats(uthread_stats_t *stats)
+{
+	if (stats == NULL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	disableInterrupts();
+	*stats = _stats;
+	enableInterrupts();
+	return SUCCESS;
+}
+
+/* Select the clock that drives preemption */
+int uthread_set_timer_source(TimerSource source)
+{
+	if (running != NULL ||
+	    (source != TIMER_VIRTUAL && source != TIMER_MONOTONIC && source != TIMER_THREAD_CPU))
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	_timer_source = source;
+	return SUCCESS;
+}
+
+/* Create a CPU budget group */
+int uthread_group_create(int budget_usecs)
+{
+	if (budget_usecs <= 0)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	disableInterrupts();
+
+	int gid;
+	if (!_free_groups.empty())
+	{
+		gid = _free_groups.back();
+		_free_groups.pop_back();
+	}
+	else if (_group_count < MAX_GROUP_NUM)
+	{
+		gid = _group_count++;
+	}
+	else
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	budget_group_t& group = _groups[gid];
+	group.budget_ns = budget_usecs * 1000UL;
+	group.used_ns = 0;
+	group.period = nowNs() / GROUP_PERIOD_NS;
+	group.in_use = true;
+
+	enableInterrupts();
+	return gid;
+}
+
+/* Delete a CPU budget group */
+int uthread_group_delete(int gid)
+{
+	disableInterrupts();
+
+	if (gid < 0 || gid >= _group_count || !_groups[gid].in_use)
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	// Charge the running thread before it leaves the group
+	if (_grouped_threads > 0)
+	{
+		chargeRunning(nowNs());
+	}
+
+	for (thread_map_t::iterator iter = _threads.begin(); iter != _threads.end(); ++iter)
+	{
+		if (iter->second->getGroup() == gid)
+		{
+			iter->second->setGroup(NO_GROUP);
+			_grouped_threads--;
+		}
+	}
+	releaseThrottled(_groups[gid]);
+	_groups[gid].in_use = false;
+	_free_groups.push_back(gid);
+
+	enableInterrupts();
+	return SUCCESS;
+}
+
+/* Move a thread to a CPU budget group */
+int uthread_set_group(int tid, int gid)
+{
+	disableInterrupts();
+
+	thread_map_t::iterator iter = _threads.find(tid);
+	if (iter == _threads.end())
+	{
+		enableInterrupts();
+		printError(NOT_FOUND_ID, THREAD_ERROR);
+		return FAIL;
+	}
+	if (gid != NO_GROUP && (gid < 0 || gid >= _group_count || !_groups[gid].in_use))
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	TCB* th = iter->second;
+	int old_gid = th->getGroup();
+	if (old_gid == gid)
+	{
+		enableInterrupts();
+		return SUCCESS;
+	}
+
+	// Charge the running thread's time so far to the group it ran in
+	unsigned long now = nowNs();
+	if (_grouped_threads > 0)
+	{
+		chargeRunning(now);
+	}
+	else
+	{
+		_run_start_ns = now;
+	}
+
+	// A thread held back by its old group's budget is ready again. A ready
+	// thread keeps its place in the ready queue
+	if (th->getState() == THROTTLED)
+	{
+		TCBQueue::remove(th);
+		th->setState(READY);
+		addToReady(th);
+	}
+
+	_grouped_threads += (gid != NO_GROUP) - (old_gid != NO_GROUP);
+	th->setGroup(gid);
+
+	enableInterrupts();
+	return SUCCESS;
+}
+
+/* Record every scheduling decision to a log file */
+int uthread_record_schedule(const char *path)
+{
+	if (path == NULL || running != NULL || _schedule_mode != SCHEDULE_NORMAL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	_schedule_file = fopen(path, "wb");
+	schedule_log_header_t header = {SCHEDULE_LOG_MAGIC, SCHEDULE_LOG_VERSION};
+	if (_schedule_file == NULL || fwrite(&header, sizeof(header), 1, _schedule_file) != 1)
+	{
+		closeScheduleLog();
+		printError(SCHEDULE_LOG_ERROR, SYS_ERROR);
+		return FAIL;
+	}
+
+	// Flush whatever is buffered when the program exits
+	atexit(closeScheduleLog);
+	_schedule_mode = SCHEDULE_RECORD;
+	schedule_tracing = true;
+	return SUCCESS;
+}
+
+/* Replay the scheduling decisions in a log written by uthread_record_schedule */
+int uthread_replay_schedule(const char *path)
+{
+	if (path == NULL || running != NULL || _schedule_mode != SCHEDULE_NORMAL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	FILE* file = fopen(path, "rb");
+	schedule_log_header_t header;
+	if (file == NULL || fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != SCHEDULE_LOG_MAGIC || header.version != SCHEDULE_LOG_VERSION)
+	{
+		if (file != NULL)
+		{
+			fclose(file);
+		}
+		printError(SCHEDULE_LOG_ERROR, SYS_ERROR);
+		return FAIL;
+	}
+
+	schedule_record_t record;
+	_replay_log.clear();
+	while (fread(&record, sizeof(record), 1, file) == 1)
+	{
+		_replay_log.push_back(record);
+	}
+	fclose(file);
+
+	_replay_pos = 0;
+	if (!_replay_log.empty())
+	{
+		_schedule_mode = SCHEDULE_REPLAY;
+		schedule_tracing = true;
+	}
+	return SUCCESS;
+}
+
+/* Turn on stack profiling */
+int uthread_profile_stacks(void)
+{
+	if (running != NULL)
+	{
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+
+	TCB::setStackPainting(true);
+	_stack_profiling = true;
+	atexit(reportStacks);
+	return SUCCESS;
+}
+
+/* Get the most stack a thread has used */
+int uthread_get_stack_usage(int tid)
+{
+	disableInterrupts();
+
+	thread_map_t::iterator iter = _threads.find(tid);
+	if (!_stack_profiling || tid == MAIN_THREAD || iter == _threads.end())
+	{
+		enableInterrupts();
+		printError(WRONG_INPUT, THREAD_ERROR);
+		return FAIL;
+	}
+	int usage = iter->second->getStackUsage();
+
+	enableInterrupts();
+	return usage;
+}
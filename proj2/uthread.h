@@ -1,6 +1,11 @@
 #ifndef _UTHREADS_H
 #define _UTHREADS_H
 
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
 /*
  * User-Level Threads Library (uthreads)
  * Author: OS, huji.os.2015@gmail.com
@@ -9,9 +14,44 @@
 #define MAX_THREAD_NUM 100 /* maximal number of threads */
 #define STACK_SIZE (16 * 1024) /* stack size per thread (in bytes) */
 #define SPINLOCK 0
+#define MAX_KEYS 1024 /* maximal number of thread-local storage keys */
+#define MAX_GROUP_NUM 1024 /* maximal number of CPU budget groups */
+#define GROUP_PERIOD_USECS 100000 /* period over which a group's budget is refilled */
+#define NO_GROUP -1
 
 enum Priority {GREEN, ORANGE, RED};
 
+/* Clocks that can drive preemption */
+enum TimerSource {
+	TIMER_VIRTUAL,    // setitimer(ITIMER_VIRTUAL): user-mode CPU time of the process
+	TIMER_MONOTONIC,  // timer_create(CLOCK_MONOTONIC): wall-clock time
+	TIMER_THREAD_CPU  // timer_create(CLOCK_THREAD_CPUTIME_ID): user and system CPU time of this kernel thread
+};
+
+/* Output formats of uthread_dump_lock_stats */
+enum LockStatsFormat {
+	LOCK_STATS_TABLE,  // Aligned columns for reading
+	LOCK_STATS_CSV     // Comma separated, one line per lock after a header line
+};
+
+/* Orders of uthread_dump_lock_stats, all but LOCK_SORT_NAME highest first */
+enum LockStatsSort {
+	LOCK_SORT_WAIT,          // Total time threads waited for the lock
+	LOCK_SORT_MAX_WAIT,      // Longest single wait
+	LOCK_SORT_CONTENDED,     // Acquisitions that had to wait
+	LOCK_SORT_ACQUISITIONS,  // All acquisitions
+	LOCK_SORT_NAME           // Lock name, alphabetically
+};
+
+/* Scheduler statistics */
+typedef struct uthread_stats {
+	unsigned long switches;          // Context switches
+	unsigned long handoffs;          // Completed uthread_yield_to switches
+	unsigned long handoff_total_ns;  // Total uthread_yield_to latency
+	unsigned long handoff_max_ns;    // Worst uthread_yield_to latency
+	unsigned long throttles;         // Threads held back by their group's budget
+} uthread_stats_t;
+
 /* Initialize the thread library */
 // Return 0 on success, -1 on failure
 int uthread_init(int quantum_usecs);
@@ -20,6 +60,20 @@ int uthread_init(int quantum_usecs);
 // Return new thread ID on success, -1 on failure
 int uthread_create(void* (*start_routine)(void*), void* arg);
 
+/* Create a new thread whose argument lives at the top of its own stack */
+// arg_size bytes are reserved at the top of the new thread's stack and
+// init(buffer, init_arg) is called to fill them in before the thread can run.
+// start_routine is passed the reserved buffer as its argument
+// Return new thread ID on success, -1 on failure
+int uthread_create_with_stack_arg(void* (*start_routine)(void*), size_t arg_size,
+                                  void (*init)(void* buffer, void* init_arg), void* init_arg);
+
+/* Create n threads whose entry point is start_routine */
+// Thread i is passed args[i] (NULL if args is NULL) and its ID is stored in
+// tids[i] if tids is not NULL. Either all n threads are created or none are
+// Return 0 on success, -1 on failure
+int uthread_create_many(int n, void* (*start_routine)(void*), void* args[], int tids[]);
+
 /* Join a thread */
 // Return 0 on success, -1 on failure
 int uthread_join(int tid, void **retval);
@@ -40,6 +94,12 @@ int uthread_suspend(int tid);
 // Return 0 on success, -1 on failure
 int uthread_resume(int tid);
 
+/* Switch directly to a ready thread */
+// The calling thread goes to the back of its ready queue and thread tid runs
+// for the rest of the caller's quantum
+// Return 0 on success, -1 on failure (including tid not being ready)
+int uthread_yield_to(int tid);
+
 /* Get the id of the calling thread */
 // Return the thread ID
 int uthread_self();
@@ -62,4 +122,115 @@ int uthread_decrease_priority(int tid);
 // Set thread with id tid to priority priority
 int uthread_set_priority(int tid, Priority priority);
 
+/* Create a thread-local storage key */
+// destructor, if not null, is called with a thread's value for the key when
+// that thread exits with a non-null value stored
+// Return 0 on success and store the key in *key, -1 on failure
+int uthread_key_create(int *key, void (*destructor)(void*));
+
+/* Delete a thread-local storage key */
+// Values stored for the key are dropped without calling the destructor
+// Return 0 on success, -1 on failure
+int uthread_key_delete(int key);
+
+/* Get the calling thread's value for a thread-local storage key */
+// Return the value, NULL if none has been set
+void* uthread_getspecific(int key);
+
+/* Set the calling thread's value for a thread-local storage key */
+// Return 0 on success, -1 on failure
+int uthread_setspecific(int key, const void* value);
+
+/* Create a CPU budget group */
+// Threads in the group may run for budget_usecs in total in every
+// GROUP_PERIOD_USECS period. Once the budget is spent, they are kept off the
+// ready queues until the next period starts
+// Return the new group ID on success, -1 on failure
+int uthread_group_create(int budget_usecs);
+
+/* Delete a CPU budget group */
+// Threads in the group leave it and throttled ones become ready again
+// Return 0 on success, -1 on failure
+int uthread_group_delete(int gid);
+
+/* Move a thread to a CPU budget group */
+// gid may be NO_GROUP to take the thread out of its group
+// Return 0 on success, -1 on failure
+int uthread_set_group(int tid, int gid);
+
+/* Select the clock that drives preemption */
+// Must be called before uthread_init, or set UTHREAD_TIMER to virtual,
+// monotonic or thread_cpu in the environment. The default is TIMER_VIRTUAL.
+// The other sources use a timer_create timer that signals only the kernel
+// thread that called uthread_init
+// Return 0 on success, -1 on failure
+int uthread_set_timer_source(TimerSource source);
+
+/* Get the scheduler statistics */
+// Return 0 on success, -1 on failure
+int uthread_get_stats(uthread_stats_t *stats);
+
+/* Record every scheduling decision to a log file */
+// Must be called before uthread_init, or set UTHREAD_RECORD=<path> in the
+// environment. The log is flushed when the program exits
+// Return 0 on success, -1 on failure
+int uthread_record_schedule(const char *path);
+
+/* Replay the scheduling decisions in a log written by uthread_record_schedule */
+// Must be called before uthread_init, or set UTHREAD_REPLAY=<path> in the
+// environment. Timer preemptions are made at the same library calls and every
+// switch picks the logged thread. If the run stops matching the log, a warning
+// is printed and normal scheduling takes over
+// Return 0 on success, -1 on failure
+int uthread_replay_schedule(const char *path);
+
+/* Turn on stack profiling */
+// Must be called before uthread_init, or set UTHREAD_STACK_PROFILE in the
+// environment. New thread stacks are painted with a canary pattern, and a
+// histogram of every thread's stack high-water mark is printed to stderr when
+// the program exits
+// Return 0 on success, -1 on failure
+int uthread_profile_stacks(void);
+
+/* Get the most stack a thread has used */
+// Return the high-water mark in bytes, -1 on failure (including stack
+// profiling being off and tid being the main thread, which runs on the
+// process stack)
+int uthread_get_stack_usage(int tid);
+
+/* Turn lock profiling on or off */
+// Can be called at any time, or set UTHREAD_LOCK_PROFILE in the environment
+// to profile the whole run and print the statistics to stderr when the program
+// exits. Only locks constructed with a name (Lock(name), SpinLock(name)) are
+// profiled: acquisitions, contended acquisitions, wait times, a histogram of
+// hold times and the threads that waited the longest
+// Return 0 on success, -1 on failure
+int uthread_profile_locks(int enable);
+
+/* Print the statistics of every named lock */
+// Return 0 on success, -1 on failure
+int uthread_dump_lock_stats(FILE *out, LockStatsFormat format, LockStatsSort sort);
+
+/* Allocate memory */
+// Safe to call from any uthread without the risk of being preempted while
+// holding malloc's lock, and cheaper than masking the timer. Requests up to
+// 2 KB come from size-class free lists with a small cache per thread,
+// larger ones from malloc
+// Return the memory, NULL on failure
+void* uthread_malloc(size_t size);
+
+/* Free memory from uthread_malloc */
+// Any thread may free memory another thread allocated
+void uthread_free(void* ptr);
+
+/* Scheduler-aware versions of blocking calls */
+// Only the calling thread is parked while the call waits, the other threads
+// keep running. Link with $(WRAP_SYSCALLS) from the Makefile to route plain
+// sleep/usleep/nanosleep/read/write calls in the program through these
+unsigned int uthread_sleep(unsigned int seconds);
+int uthread_usleep(useconds_t usec);
+int uthread_nanosleep(const struct timespec *req, struct timespec *rem);
+ssize_t uthread_read(int fd, void *buf, size_t count);
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
 #endif
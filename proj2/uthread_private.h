@@ -7,6 +7,8 @@
 #define UTHREAD_PRIVATE
 
 #include "TCB.h"
+#include "TCBQueue.h"
+#include <atomic>
 
 extern TCB* running; // The "Running" thread
 
@@ -16,15 +18,85 @@ extern TCB* running; // The "Running" thread
 //       of the newly running thread to RUNNING
 void switchThreads();
 
-// Switch to the thread provided
+// Switch to the thread provided. The new thread gets a fresh quantum unless
+// restart_quantum is false, in which case it runs out the current one
 // NOTE: Same note for switchThreads applies for switchToThread
-void switchToThread(TCB *tcb);
+void switchToThread(TCB *tcb, bool restart_quantum = true);
+
+// Switch to target for the rest of the running thread's quantum, leaving the
+// running thread ready. Return false if target is not on a ready queue
+// NOTE: Assumes interrupts are disabled
+bool yieldTo(TCB *target);
+
+// Block the running thread until CLOCK_MONOTONIC reaches deadline_ns
+// NOTE: Assumes interrupts are disabled
+void sleepUntil(unsigned long deadline_ns);
+
+// Block the running thread until another module wakes it up or
+// CLOCK_MONOTONIC reaches deadline_ns, whichever comes first. The caller puts
+// the running thread on its wait queue first. If the deadline passes while the
+// thread is still blocked, cancel(thread, arg) is called to take it off that
+// queue, and the thread is made ready if cancel returns true. Returning false
+// leaves it blocked, for a thread that has moved on to wait for something else
+// If next is given, switch to it instead of the next ready thread
+// Return false if the thread was woken up by the deadline
+// NOTE: Assumes interrupts are disabled
+bool blockUntil(unsigned long deadline_ns, bool (*cancel)(TCB *tcb, void *arg), void *arg,
+                TCB *next = NULL);
+
+// Block the running thread until poll() reports one of events on fd
+// NOTE: Assumes interrupts are disabled
+void waitForFd(int fd, short events);
+
+// Return the current CLOCK_MONOTONIC time in nanoseconds
+unsigned long nowNs();
 
 // Add the provided thread to the ready queue
 void addToReady(TCB* th);
 
+// Make every thread in queue ready and move them all to the ready queue,
+// leaving queue empty
+void addAllToReady(TCBQueue& queue);
+
+// Follow up on a change of tcb's scheduling priority from old_priority: move
+// it to the matching ready queue, and if it is blocked on a Lock, pass the
+// change on to the lock's owner (see Lock.cpp)
+// NOTE: Assumes interrupts are disabled
+void priorityChanged(TCB *tcb, Priority old_priority);
+
 // Disable/enable interrupts
 void disableInterrupts();
 void enableInterrupts();
 
+// Set while a schedule is recorded or replayed. Library calls that skip
+// disableInterrupts on a fast path must take the slow path then, so every call
+// is a record/replay checkpoint
+extern bool schedule_tracing;
+
+extern volatile int preempt_disable_count; // Nesting depth of preemptDisable
+extern volatile bool preempt_pending;      // Set by a timer tick preemptDisable held off
+
+// Run the preemption a timer tick left pending
+void runPendingPreemption();
+
+// Keep the timer from switching threads without masking the signal, which
+// costs two system calls. A tick that lands in between is held off until
+// preemptEnable
+// NOTE: Only guards against preemption. Code that blocks or switches threads
+//       itself needs disableInterrupts
+inline void preemptDisable()
+{
+    preempt_disable_count++;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+inline void preemptEnable()
+{
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (--preempt_disable_count == 0 && preempt_pending)
+    {
+        runPendingPreemption();
+    }
+}
+
 #endif // UTHREAD_PRIVATE
@@ -0,0 +1,128 @@
+// Scheduler-aware wrappers for blocking calls. A wrapped call parks only the
+// calling thread on the scheduler's timer or fd wait list instead of putting
+// the whole process (and every other uthread) to sleep in the kernel.
+//
+// NOTE: The fallbacks use clock_nanosleep and syscall() directly so they are
+//       not redirected back here when the program is linked with --wrap
+
+#include "uthread.h"
+#include "uthread_private.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define NANO_TO_SECOND 1000000000UL
+
+/*
+ * Parks the running thread until poll() reports one of events on fd. Returns
+ * right away if fd is already ready (or in error)
+ */
+static void waitUntilReady(int fd, short events)
+{
+	struct pollfd pfd = { fd, events, 0 };
+
+	// NOTE: Another thread may drain the fd between the wake-up and the
+	//       call, so check again after being woken up
+	while (poll(&pfd, 1, 0) == 0)
+	{
+		disableInterrupts();
+		waitForFd(fd, events);
+		enableInterrupts();
+	}
+}
+
+int uthread_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	if (req == NULL || req->tv_sec < 0 || req->tv_nsec < 0 ||
+	    req->tv_nsec >= (long)NANO_TO_SECOND)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Not called from a uthread, sleep for real
+	if (running == NULL)
+	{
+		int err = clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+		if (err != 0)
+		{
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+
+	disableInterrupts();
+	sleepUntil(nowNs() + req->tv_sec * NANO_TO_SECOND + req->tv_nsec);
+	enableInterrupts();
+
+	if (rem)
+	{
+		rem->tv_sec = 0;
+		rem->tv_nsec = 0;
+	}
+	return 0;
+}
+
+unsigned int uthread_sleep(unsigned int seconds)
+{
+	struct timespec req = { (time_t)seconds, 0 };
+	uthread_nanosleep(&req, NULL);
+	return 0;
+}
+
+int uthread_usleep(useconds_t usec)
+{
+	struct timespec req = { (time_t)(usec / 1000000), (long)(usec % 1000000) * 1000 };
+	return uthread_nanosleep(&req, NULL);
+}
+
+ssize_t uthread_read(int fd, void *buf, size_t count)
+{
+	if (running != NULL)
+	{
+		waitUntilReady(fd, POLLIN);
+	}
+	return syscall(SYS_read, fd, buf, count);
+}
+
+ssize_t uthread_write(int fd, const void *buf, size_t count)
+{
+	if (running != NULL)
+	{
+		waitUntilReady(fd, POLLOUT);
+	}
+	return syscall(SYS_write, fd, buf, count);
+}
+
+// Targets for the linker's --wrap=<symbol> (see WRAP_SYSCALLS in the Makefile)
+extern "C"
+{
+
+unsigned int __wrap_sleep(unsigned int seconds)
+{
+	return uthread_sleep(seconds);
+}
+
+int __wrap_usleep(useconds_t usec)
+{
+	return uthread_usleep(usec);
+}
+
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	return uthread_nanosleep(req, rem);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	return uthread_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	return uthread_write(fd, buf, count);
+}
+
+}